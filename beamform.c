@@ -2,17 +2,63 @@
 // Created by: Richard Sampson, Amlan Nayak, Thomas F. Wenisch
 // Revision 1.0 - 11/15/16
 
+#define _GNU_SOURCE // pthread_setaffinity_np and cpu_set_t for --numa
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <sys/time.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdarg.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include "beamform.h"
+
+// Every kernel and the transmit path round delays the same way: no FMA contraction,
+// whatever -march the build picks (it would move indices by a sample on some points)
+#pragma GCC optimize("fp-contract=off")
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__MIC__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
+// Default task counts per phase; the worker pool itself is sized from the core count.
+// All of them can be overridden with --*-tasks/--threads or BEAMFORM_* environment variables.
 #define NUM_THREADS_REFLECT 16
 #define NUM_THREADS_TRANSMIT 2
 #define NUM_THREADS_X 8
+#define STEAL_GRAIN 8 // Reflect tasks per pool thread the tiled engine splits the image and receivers into
+#define GRID_R 1560 // Radial points per scanline of the input grid, whatever region a plan keeps
+
+#define TX_FLOPS 9 // Flops per point in transmit_distance (sqrt counted as one)
+#define RX_FLOPS 14 // Flops per (receiver, point) in the reflect kernels
+#define RX_BYTES 24 // Bytes per (receiver, point) for the naive loop: 4 coordinate/dist_tx loads, 1 gather, image read+write
+
+#define LOAD_READ 0 // fread the input into malloc'd arrays
+#define LOAD_MMAP 1 // Map the input file and point the arrays into the mapping
+#define LOAD_PIPELINE 2 // fread the geometry, then stream rx_data in while the plan and transmit run
+
+#define PERF_EVENTS 4 // --perf counters per thread: cycles, instructions, LLC misses, stalled cycles
+#define PERF_PHASES 3 // transmit, reflect, merge
+
+#define MAX_NODES 8 // NUMA nodes used by --numa, the rest share node 0's data
+
+#define SYM_X 1 // Mirror x -> -x: receiver column i <-> trans_x-1-i, theta row t <-> sls_t-1-t
+#define SYM_Y 2 // Mirror y -> -y: receiver row j <-> trans_y-1-j, phi column p <-> sls_p-1-p
 
 
 typedef struct thread_args{
@@ -29,28 +75,108 @@ typedef struct args_divide_x{
 	float *image_temp;
 }args_divide_x;
 
-int sls_t; // Number of scanlines in theta
-int sls_p;
-int pts_r = 1560; // Radial points along scanline
+typedef struct args_merge{
+	int start; // Image points summed by this task
+	int end;
+	float **parts; // Private images to add into image
+	int num_parts;
+}args_merge;
+
+typedef struct args_tile{
+	int scan_start; // Scanlines of the tile
+	int scan_end;
+	int r_start; // Radial segment taken from each scanline
+	int r_end;
+	int rx_start; // Receivers swept over the tile
+	int rx_end;
+	float *image_temp;
+	pthread_mutex_t *lock; // Serializes the image update when receiver chunks share the tile, else NULL
+}args_tile;
+
+// One call to pool_run: count tasks of fn, each given args + i*stride
+typedef struct pool_batch{
+	void *(*fn)(void *);
+	char *args;
+	size_t stride;
+	int count;
+	int claimed; // Tasks handed out so far
+	int done; // Tasks finished so far
+	int workers; // Workers 0..workers-1 may run its tasks, besides the caller
+	const struct bf_plan *state; // The caller's plan state, loaded by the workers that run its tasks
+	uint64_t state_id; // Unique per batch, so a worker reloads only when the batch changes
+}pool_batch;
+
+// Tasks next..end-1 of one batch still waiting in a deque
+typedef struct pool_range{
+	pool_batch *batch;
+	int next;
+	int end;
+}pool_range;
+
+// Per-thread work-stealing deque. The owner takes single tasks from the front of its
+// newest range; thieves split off the back half of the oldest range.
+typedef struct pool_deque{
+	pthread_mutex_t lock;
+	pool_range *ranges; // Oldest first, never empty ranges
+	int count;
+	int cap;
+}pool_deque;
+
+// Persistent workers shared by transmit, reflect and divide_x tasks
+typedef struct worker_pool{
+	pthread_t *threads;
+	int num_threads;
+	pool_deque *deques; // One per thread, the caller of pool_init last
+	int *slot_nodes; // NUMA node of each thread
+	int queued; // Tasks pushed to a deque and not yet claimed
+	uint64_t steals; // Steals since compute_image started
+	pthread_mutex_t lock; // Guards sleeping and waking only
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	int shutdown;
+	int cores; // Online cores when the pool started, the share of plans with threads <= 0
+	int in_flight; // Batches running, under lock
+	int widest; // Largest workers of the batches running, workers past it sleep
+	uint64_t batches; // Batches started, for state_id
+}worker_pool;
+
+__thread int sls_t; // Number of scanlines in theta
+__thread int sls_p;
+__thread int pts_r = GRID_R; // Radial points along scanline (of the region, inside a plan)
 
 float tx_x = 0; // Transmit transducer x position
 float tx_y = 0; // Transmit transducer y position
 float tx_z = -0.001; // Transmit transducer z position
 
-float *point_x; // Point x position
-float *point_y; // Point y position
-float *point_z; // Point z position
+__thread float *point_x; // Point x position
+__thread float *point_y; // Point y position
+__thread float *point_z; // Point z position
 
-float *dist_tx; // Transmit distance (ie first leg only)
+__thread float *dist_tx; // Transmit distance (ie first leg only)
+
+// Parametric geometry: point (scanline, it_r) = scan_*0[scanline] + it_r * scan_d*[scanline]
+// (double, so the generated floats round the same way as the stored ones)
+__thread double *scan_x0;
+__thread double *scan_y0;
+__thread double *scan_z0;
+__thread double *scan_dx;
+__thread double *scan_dy;
+__thread double *scan_dz;
+const float geometry_tol = 1e-7; // Max point deviation (m) --geometry=param accepts, ~1% of a sample
+// A progressive pass shares the geometry of its whole region: image radial point it_r is
+// geometry point radial_offset + it_r * radial_stride of a scanline of geometry_r points
+__thread int radial_offset = 0;
+__thread int radial_stride = 1;
+__thread int geometry_r = GRID_R;
 
 
 int trans_x = 32; // Transducers in x dim
 int trans_y = 32; // Transducers in y dim
 
-float *image;  // Pointer to full image (accumulated so far)
+__thread float *image;  // Pointer to full image (accumulated so far)
 
-float *rx_x; // Receive transducer x position
-float *rx_y; // Receive transducer y position
+__thread float *rx_x; // Receive transducer x position
+__thread float *rx_y; // Receive transducer y position
 float rx_z = 0; // Receive transducer z position
 
 
@@ -58,356 +184,4063 @@ const float idx_const = 0.000009625; // Speed of sound and sampling rate, conver
 const int filter_delay = 140; // Constant added to index to account filter delay (off by 1 from MATLAB)
 
 int data_len = 12308; // Number for pre-processed data values per channel
-float *rx_data; // Pointer to pre-processed receive channel data
+__thread float *rx_data; // Pointer to pre-processed receive channel data
+__thread int rx_format = RX_FLOAT; // --rx-format=float|fp16|int16: storage the reflect kernels gather from
+__thread int specialize = 1; // --specialize=on|off: use the fixed-size kernels when the configuration has them
+__thread int symmetry = 1; // --symmetry=on|off: share receive distances between mirrored (receiver, point) pairs
+__thread int sym_axes = 0; // Mirrors the loaded geometry is exactly invariant under, found by detect_symmetry
+__thread int sym_mirrors = 0; // Mirrors the current pass exploits, 0 when it computes every pair
+__thread int sym_t, sym_p; // Theta rows and phi columns the reflect pass visits, the rest are mirror images
+__thread void *rx_compact = NULL; // 16-bit copy of rx_data for RX_HALF and RX_INT16, two samples of padding
+__thread float rx_scale = 1; // Value of one int16 step in RX_INT16
+
+__thread int size;
+
+__thread int total_angles;
+
+// --roi=T0:T1,P0:P1,R0:R1: beamform only theta rows T0..T1-1, phi columns P0..P1-1 and
+// radial points R0..R1-1; the image then holds just that box. All 0 = the whole volume.
+int roi_t_start = 0, roi_t_end = 0;
+int roi_p_start = 0, roi_p_end = 0;
+int roi_r_start = 0, roi_r_end = 0;
+int r_step = 1; // --decimate=K: keep every K-th radial point of the region
+
+__thread int reflect_engine = REFLECT_TILED; // --reflect=tiled|receiver
+__thread int tile_pts = 2048; // Image points per reflect tile, --tile=N
+__thread int tile_len = 128; // Radial points per scanline in a tile, --tile-len=N
+uint64_t window_samples, window_sweeps; // Channel window widths seen by the tiled engine
+__thread int transmit_tasks = NUM_THREADS_TRANSMIT; // Scanline ranges in the transmit phase
+__thread int reflect_tasks = NUM_THREADS_REFLECT; // Receiver groups in private reduce mode
+__thread int x_tasks = NUM_THREADS_X; // Theta slices per receiver in the receiver engine
+__thread int num_threads = 0; // Pool size including the main thread, 0 = one per online core
+__thread int num_rx; // Receivers beamformed, trans_x * trans_y except during autotuning
+__thread int reduce_mode = REDUCE_OWNER; // --reduce=owner|private
+__thread int simd_mode = SIMD_AUTO; // --simd=auto|scalar|avx2|avx512
+__thread int geometry_mode = GEOMETRY_AUTO; // --geometry=auto|stored|param
+int load_mode = LOAD_READ; // --load=read|mmap|pipeline
+__thread int geometry_fit = GEOMETRY_STORED; // What fit_geometry settled on
+__thread int keep_points = 0; // Keep point_x/y/z even with parametric geometry (benchmark variants need them)
+__thread int borrowed_points = 0; // point_x/y/z are the caller's arrays, used in place and never freed
+__thread int shared_geometry = 0; // rx_x/y, point_x/y/z and scan_* belong to another plan (a progressive pass)
+__thread int shared_frame = 0; // rx_compact and the node replicas are another plan's, loaded once per frame there
+__thread char *plan_notes = NULL; // What setting the plan up decided or fell back to, for bf_plan_status
+
+// Frame still being loaded (--load=pipeline): receiver rows arrive in mirror pairs,
+// row 0 with row trans_x-1, then 1 with trans_x-2 and so on. NULL once it is all resident.
+// Only passes over that frame wait on it; every other frame is resident already.
+typedef struct rx_gate{
+	const float *frame; // The frame being loaded
+	int pairs; // Row pairs resident so far
+	uint64_t waited; // Usec the reflect pass spent waiting for them
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+}rx_gate;
+
+rx_gate *rx_arrival = NULL;
+
+char *stream_path = NULL; // --stream=FILE|-: beamform successive rx_data frames from FILE or stdin
+int progressive = 1; // --progressive=K: single frames in K radial passes, publishing the volume after each
+__thread int reuse_dist_tx = 0; // dist_tx already holds this geometry's transmit distances
+
+// Double buffer between the frame loader thread and the beamforming loop
+typedef struct frame_stream{
+	FILE *file;
+	float *frames[2];
+	int ready[2]; // Slot holds a loaded frame not yet beamformed
+	int eof;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+}frame_stream;
+
+int bench_trials = 0; // --bench=N: time the compute phases N times
+int bench_warmup = 1; // --warmup=N: untimed runs before each variant
+char *bench_variants = "beamform"; // --variants=og,outer_loop,beamform
+
+// Engine settings that benchmark variants (and the autotuner) switch between
+typedef struct engine_config{
+	int reflect_engine;
+	int reduce_mode;
+	int simd_mode;
+	int geometry_mode;
+	int tile_pts;
+	int transmit_tasks;
+	int reflect_tasks;
+	int x_tasks;
+	int threads;
+	int use_tables;
+	int rx_format;
+	int specialize;
+	int symmetry;
+}engine_config;
+
+#define TUNE_OFF 0
+#define TUNE_CACHED 1 // --autotune: reuse the cached winner for this machine and size, else tune
+#define TUNE_FORCE 2 // --autotune=force: always re-tune and overwrite the cache
+
+int autotune = TUNE_OFF;
+char *tune_path = "beamform_tune.cache"; // --tune-file=FILE
+int tune_receivers = 64; // Receivers per autotune trial run
+
+int map_populate = 0; // --populate: prefault the whole mapping with MAP_POPULATE
+int map_hugepages = 0; // --hugepages: madvise(MADV_HUGEPAGE) on the mapping
+
+char *input_path = NULL; // --input=FILE, defaults to the course data share
+char *output_path = NULL; // --output=FILE, defaults to beamforming_output.bin
+
+void *input_map = NULL; // Mapping of the input file in mmap mode
+size_t input_map_len;
 
-int size;
+// Delay-and-sum over count consecutive points for one receiver: acc[i] += data[index(i)]
+typedef void (*rx_kernel_fn)(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc);
+__thread rx_kernel_fn rx_kernel;
 
-int total_angles;
+// Gather-and-accumulate through a precomputed delay table: acc[m][i] += data[m][base + off[i]],
+// m < mirrors, for a receiver and scanline and the mirror pairs sharing their delays
+typedef void (*table_kernel_fn)(int count, const uint16_t *off, int base, int mirrors, const void **data, float **acc);
+__thread table_kernel_fn table_kernel;
+
+// rx_kernel for up to four (receiver, point) pairs with equal receive distances: the index
+// computed for the points and receiver given is gathered from data[m] into acc[m], m < mirrors
+typedef void (*rx_sym_kernel_fn)(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, int mirrors, const void **data, float **acc);
+__thread rx_sym_kernel_fn rx_sym_kernel;
+
+__thread const struct kernel_spec *spec = NULL; // Specialization picked by select_rx_kernel, NULL for generic
+__thread rx_kernel_fn scan_kernel; // rx_kernel for exactly pts_r points when spec is set
+__thread rx_kernel_fn tile_kernel; // rx_kernel for exactly spec->tile_count points when spec is set
+
+// Delay tables: for receivers below table_rx, the rx_data index of radial point r on the
+// v-th scanline the reflect pass visits (sym_scan(v)) is
+// table_base[rx * table_scans + v] + table_off[(rx * table_scans + v) * pts_r + r]
+__thread int table_mb = 0; // --table-mb=N: memory budget for delay tables, 0 disables them
+__thread int use_tables = 0; // Table lookups enabled for the current settings
+__thread int table_rx = 0; // Receivers with a cached table (the first table_rx of the array)
+__thread int table_scans = 0; // Visited scanlines per receiver, sym_t * sym_p at build time
+__thread int table_mirrors = 0; // sym_mirrors the tables were laid out for
+__thread int table_live = 0; // Receivers the current pass reads from the tables, 0 when it computes every index
+__thread int tables_built = 0;
+__thread int32_t *table_base;
+__thread uint16_t *table_off;
+
+int check_exact = 0; // --check: also run the exact path and report the RMS difference
 
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
-// with 8 threads we are able to double performace for transmit distance
-void *transmit_distance(void *arg){
+worker_pool pool;
 
-	thread_args *thread_info = (struct thread_args *) arg;
+// NUMA mode: workers are pinned round the nodes, each batch's tasks are split into one
+// contiguous share per node (stolen across nodes only once a node runs dry), and the big arrays
+// are first-touched in matching slices so a share's data is local to its node.
+int numa_mode = 0; // --numa
+int pool_nodes = 1; // Nodes tasks and data are split across, 1 unless --numa
+cpu_set_t node_cpus[MAX_NODES];
+int node_cpu_count[MAX_NODES];
+__thread int worker_node = 0; // Node of the calling thread
+__thread void *rx_node_data[MAX_NODES]; // Per-node copies of the channel storage in rx_node_format
+__thread int rx_node_format = -1; // Format of the replicas, -1 before the first replicate_rx
+uint64_t node_local_bytes[MAX_NODES], node_remote_bytes[MAX_NODES]; // Modeled reflect traffic
 
-	/* First compute transmit distance */
-	int point;
-	int it_t; // Iterator for theta
-	int it_p; // Iterator for phi
-	int it_r; // Iterator for r
+// A plan owns one configuration: its settings, its copy of the geometry and everything
+// derived from them (dist_tx, delay tables, 16-bit and per-node channel copies, the kernel
+// choice). The kernels read all of that through the thread-local globals above, so entering
+// a plan swaps its fields with the calling thread's and leaving swaps them back; between
+// calls they hold whatever that thread (the command line) had there. pool_run hands the
+// caller's values, plus its image and rx_data, to the workers running its tasks, so plans
+// entered on different threads run side by side.
+struct bf_plan{
+	int size, sls_t, sls_p, pts_r, total_angles, num_rx, num_threads;
+	int reflect_engine, reduce_mode, simd_mode, geometry_mode, geometry_fit, keep_points, borrowed_points;
+	int radial_offset, radial_stride, geometry_r, shared_geometry, shared_frame;
+	int tile_pts, tile_len, transmit_tasks, reflect_tasks, x_tasks;
+	int table_mb, use_tables, table_rx, table_scans, table_mirrors, table_live, tables_built;
+	int rx_format, rx_node_format, reuse_dist_tx, specialize, symmetry, sym_axes;
+	int sym_mirrors, sym_t, sym_p;
+	float rx_scale;
+	float *rx_x, *rx_y, *point_x, *point_y, *point_z, *dist_tx;
+	double *scan_x0, *scan_y0, *scan_z0, *scan_dx, *scan_dy, *scan_dz;
+	int32_t *table_base;
+	uint16_t *table_off;
+	void *rx_compact;
+	void *rx_node_data[MAX_NODES];
+	const struct kernel_spec *spec;
+	rx_kernel_fn rx_kernel, scan_kernel, tile_kernel;
+	table_kernel_fn table_kernel;
+	rx_sym_kernel_fn rx_sym_kernel;
+	char *plan_notes; // Lines of bf_plan_status, NULL while there are none
+	float *image, *rx_data; // Not swapped: only set in pool_run's copy for the workers
+	pthread_mutex_t lock; // One bf_execute at a time: the frame copies and dist_tx are the plan's
+};
 
-	/* Variables for distance calculation and index conversion */
-	float x_comp; // Itermediate value for dist calc
-	float y_comp; // Itermediate value for dist calc
-	float z_comp; // Itermediate value for dist calc
-	int it_angle;
+#define PLAN_FIELDS(X) \
+	X(size) X(sls_t) X(sls_p) X(pts_r) X(total_angles) X(num_rx) X(num_threads) \
+	X(reflect_engine) X(reduce_mode) X(simd_mode) X(geometry_mode) X(geometry_fit) X(keep_points) \
+	X(borrowed_points) X(radial_offset) X(radial_stride) X(geometry_r) X(shared_geometry) X(shared_frame) \
+	X(tile_pts) X(tile_len) X(transmit_tasks) X(reflect_tasks) X(x_tasks) \
+	X(table_mb) X(use_tables) X(table_rx) X(table_scans) X(table_mirrors) X(table_live) X(tables_built) \
+	X(rx_format) X(rx_node_format) X(reuse_dist_tx) X(specialize) X(symmetry) X(sym_axes) \
+	X(sym_mirrors) X(sym_t) X(sym_p) X(rx_scale) \
+	X(rx_x) X(rx_y) X(point_x) X(point_y) X(point_z) X(dist_tx) \
+	X(scan_x0) X(scan_y0) X(scan_z0) X(scan_dx) X(scan_dy) X(scan_dz) \
+	X(table_base) X(table_off) X(rx_compact) \
+	X(spec) X(rx_kernel) X(scan_kernel) X(tile_kernel) X(table_kernel) X(rx_sym_kernel) \
+	X(plan_notes)
 
-	point = thread_info->start * pts_r;
+#define PLAN_STORE(name) state->name = name;
+#define PLAN_LOAD(name) name = state->name;
 
-	for(it_angle = thread_info->start; it_angle < thread_info->end; it_angle++) {
-		for (it_r = 0; it_r < pts_r; it_r++) {
+/* Copy the calling thread's plan state into state, or state into the calling thread */
+static void plan_state_store(bf_plan *state)
+{
+	int node;
 
-			x_comp = tx_x - point_x[point];
-			x_comp = x_comp * x_comp;
-			y_comp = tx_y - point_y[point];
-			y_comp = y_comp * y_comp;
-			z_comp = tx_z - point_z[point];
-			z_comp = z_comp * z_comp;
+	PLAN_FIELDS(PLAN_STORE)
+	for (node = 0; node < MAX_NODES; node++)
+		state->rx_node_data[node] = rx_node_data[node];
+	state->image = image;
+	state->rx_data = rx_data;
+}
 
-			dist_tx[point++] = (float)sqrt(x_comp + y_comp + z_comp);
-		}
+static void plan_state_load(const bf_plan *state)
+{
+	int node;
+
+	PLAN_FIELDS(PLAN_LOAD)
+	for (node = 0; node < MAX_NODES; node++)
+		rx_node_data[node] = state->rx_node_data[node];
+	image = state->image;
+	rx_data = state->rx_data;
+}
+
+/* Add a line to the current plan's notes; the library leaves printing them to its caller */
+static void plan_note(const char *format, ...)
+{
+	char line[256];
+	size_t len = plan_notes != NULL ? strlen(plan_notes) : 0;
+	char *notes;
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	notes = (char *) realloc(plan_notes, len + strlen(line) + 2);
+	if (notes == NULL) {
+		fprintf(stderr, "Bad malloc on plan notes\n");
+		return;
 	}
+	sprintf(notes + len, "%s\n", line);
+	plan_notes = notes;
 }
 
-void *divide_x_image(void *arg){
-	args_divide_x *thread_info = (struct args_divide_x *) arg;
+uint64_t now_usec()
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
+}
 
-	int it_t; // Iterator for theta
-	int it_p; // Iterator for phi
-	int it_r; // Iterator for r
-	int index; // Index into transducer data
-	float x_comp; // Itermediate value for dist calc
-	float y_comp; // Itermediate value for dist calc
-	float z_comp; // Itermediate value for dist calc
-	float dist;
+// --perf: every pool thread (workers, then the main thread last) counts its own events;
+// the main thread reads all of them at the phase boundaries of compute_image
+int perf_mode = 0;
+int perf_slots = 0; // Threads with a slot: pool.num_threads + 1
+int perf_ready = 0; // Workers that have opened their counters
+int perf_errno = 0; // First perf_event_open failure, 0 if every counter opened
+int (*perf_fd)[PERF_EVENTS]; // -1 where an event could not be opened
+uint64_t *busy_usec; // Time each thread spent running tasks, nested pool_run waits excluded
+uint64_t *perf_mark; // Counters and busy time per slot at the previous phase boundary
+uint64_t *perf_phase[PERF_PHASES]; // Per-slot deltas of the last compute_image
+__thread int worker_slot = 0;
+__thread uint64_t worker_state = 0; // state_id of the plan state this thread last loaded
+__thread int task_depth = 0;
+__thread uint64_t task_start;
+const char *perf_event_names[PERF_EVENTS] = {"cycles", "instructions", "llc-misses", "stalled-cycles"};
 
-	int it_rx = thread_info->it_rx; // Iterator for recieve transducer
-	int offset = thread_info->offset;
+/* Open this thread's counters. Stalled cycles are the backend stalls where the PMU
+ * exposes them and frontend stalls otherwise. */
+void perf_open_thread()
+{
+#ifdef __linux__
+	static const uint64_t configs[PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_STALLED_CYCLES_BACKEND};
+	struct perf_event_attr attr;
+	int *fd = perf_fd[worker_slot];
+	int event;
 
-	int point = thread_info->start * sls_p * pts_r;
-	float *image_pos = thread_info->image_temp + thread_info->start * sls_p * pts_r;
+	for (event = 0; event < PERF_EVENTS; event++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[event];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[event] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd[event] < 0 && event == PERF_EVENTS - 1) {
+			attr.config = PERF_COUNT_HW_STALLED_CYCLES_FRONTEND;
+			fd[event] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+		if (fd[event] < 0 && perf_errno == 0)
+			perf_errno = errno;
+	}
+#else
+	perf_errno = ENOSYS;
+#endif
+}
 
+/* Counter value scaled for multiplexing, 0 for an event that did not open */
+uint64_t perf_read(int fd)
+{
+	uint64_t value[3];
 
-	for (it_t = thread_info->start; it_t < thread_info->end; it_t++) {    // whatever size is
-		for (it_p = 0; it_p < sls_p; it_p++) { // whatever size is
-			for (it_r = 0; it_r < pts_r; it_r++) { //1056
-				
-				x_comp = rx_x[it_rx] - point_x[point];
-				x_comp = x_comp * x_comp;
-				y_comp = rx_y[it_rx] - point_y[point];
-				y_comp = y_comp * y_comp;
-				z_comp = rx_z - point_z[point];
-				z_comp = z_comp * z_comp;
+	if (fd < 0 || read(fd, value, sizeof(value)) != sizeof(value) || value[2] == 0)
+		return 0;
+	return value[2] < value[1] ? (uint64_t)((double)value[0] * value[1] / value[2]) : value[0];
+}
 
+/* Exclusive task time: the enclosing task's clock stops while this thread runs a
+ * nested task or waits in a nested pool_run */
+static void busy_pause()
+{
+	if (perf_mode && task_depth > 0)
+		busy_usec[worker_slot] += now_usec() - task_start;
+}
 
-				dist = dist_tx[point++] + (float)sqrt(x_comp + y_comp + z_comp); // change to local
-				index = (int)(dist/idx_const + filter_delay + 0.5);
-				*image_pos += rx_data[index+offset];
-				image_pos++;
-			}
+static void busy_resume()
+{
+	if (perf_mode && task_depth > 0)
+		task_start = now_usec();
+}
+
+/* Per-slot deltas since the previous boundary into perf_phase[phase] (phase < 0 just
+ * sets the mark) */
+void perf_boundary(int phase)
+{
+	uint64_t value;
+	int slot, event, k;
+
+	for (slot = 0; slot < perf_slots; slot++) {
+		for (event = 0; event <= PERF_EVENTS; event++) {
+			k = slot * (PERF_EVENTS + 1) + event;
+			value = event < PERF_EVENTS ? perf_read(perf_fd[slot][event]) : busy_usec[slot];
+			if (phase >= 0)
+				perf_phase[phase][k] = value - perf_mark[k];
+			perf_mark[k] = value;
 		}
 	}
 }
 
+/* Online nodes with CPUs from sysfs (no libnuma). Leaves pool_nodes at 1 when
+ * the machine has one node or sysfs is unavailable. */
+void read_numa_topology()
+{
+	char path[64], list[4096], *tok, *save;
+	int node, lo, hi, cpu, count;
+	FILE *file;
 
+	pool_nodes = 0;
+	for (node = 0; node < 64 && pool_nodes < MAX_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		file = fopen(path, "r");
+		if (file == NULL)
+			continue;
+		if (fgets(list, sizeof(list), file) == NULL)
+			list[0] = '\0';
+		fclose(file);
 
-void *reflect_distance(void *arg){
-/* Now compute reflected distance, find index values, add to image */
+		CPU_ZERO(&node_cpus[pool_nodes]);
+		count = 0;
+		for (tok = strtok_r(list, ",\n", &save); tok != NULL; tok = strtok_r(NULL, ",\n", &save)) {
+			if (sscanf(tok, "%d-%d", &lo, &hi) == 1)
+				hi = lo;
+			for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++, count++)
+				CPU_SET(cpu, &node_cpus[pool_nodes]);
+		}
+		if (count > 0) // Skip memory-only nodes
+			node_cpu_count[pool_nodes++] = count;
+	}
+	if (pool_nodes == 0) {
+		pool_nodes = 1;
+		node_cpu_count[0] = 0;
+	}
+}
 
-	thread_args *thread_info = (struct thread_args *) arg;
+/* Pin the calling thread to one CPU of node (the n-th, wrapping), or to the whole node for n < 0 */
+void pin_to_node(int node, int n)
+{
+	cpu_set_t set;
+	int cpu, seen = 0;
 
-	int point = 0;
-	int it_rx; // Iterator for recieve transducer
-	int it_t; // Iterator for theta
-	int it_p; // Iterator for phi
-	int it_r; // Iterator for r
-	int index; // Index into transducer data
-	float x_comp; // Itermediate value for dist calc
-	float y_comp; // Itermediate value for dist calc
-	float z_comp; // Itermediate value for dist calc
-	float dist;
-	int offset = 0;
-	float *image_pos; // Pointer to current position in image
-	float *image_temp = thread_info->image_temp;
+	worker_node = node;
+	if (node_cpu_count[node] == 0)
+		return;
+	if (n < 0) {
+		set = node_cpus[node];
+	} else {
+		CPU_ZERO(&set);
+		n %= node_cpu_count[node];
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &node_cpus[node]) && seen++ == n) {
+				CPU_SET(cpu, &set);
+				break;
+			}
+	}
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
 
-	offset = thread_info->start * data_len;
-	for (it_rx = thread_info->start; it_rx < thread_info->end; it_rx++) {  // 1024 times
+// One node's part of a placement job: copy or zero bytes at dst from a thread on that node
+typedef struct node_job{
+	int node;
+	char *dst;
+	const char *src; // NULL to zero
+	size_t bytes;
+}node_job;
 
-		//image_pos = image; // Reset image pointer back to beginning
-		point = 0;
-		image_temp = thread_info->image_temp;
+static void *node_fill(void *arg)
+{
+	node_job *job = (node_job *) arg;
 
-		args_divide_x divide_x_args[NUM_THREADS_X];
-		pthread_t child_reflect_x[NUM_THREADS_X];
+	pin_to_node(job->node, -1);
+	if (job->src != NULL)
+		memcpy(job->dst, job->src, job->bytes);
+	else
+		memset(job->dst, 0, job->bytes);
+	return NULL;
+}
 
-		int current_start, range;
-		int i = 0;
+static void run_node_jobs(node_job *jobs)
+{
+	pthread_t threads[MAX_NODES];
+	int node;
 
-		current_start = 0;
-		range = sls_t / NUM_THREADS_X;
-		for(i = 0; i < NUM_THREADS_X; i++) {
-			divide_x_args[i].start = current_start;
-			divide_x_args[i].end = current_start + range;
-			divide_x_args[i].it_rx = it_rx;
-			divide_x_args[i].offset = offset;
-			divide_x_args[i].image_temp = image_temp;
-			current_start += range;
+	for (node = 0; node < pool_nodes; node++)
+		pthread_create(&threads[node], NULL, node_fill, &jobs[node]);
+	for (node = 0; node < pool_nodes; node++)
+		pthread_join(threads[node], NULL);
+}
 
-		}
-		divide_x_args[NUM_THREADS_X-1].end = sls_t;
+/* Zero buf, first-touching slice n (page aligned) from node n so the pages are
+ * homed where the tasks of share n will use them */
+void zero_on_nodes(void *buf, size_t bytes)
+{
+	node_job jobs[MAX_NODES];
+	size_t start, end;
+	int node;
 
-		for(i = 0; i < NUM_THREADS_X; i++) {
-        	pthread_create(&child_reflect_x[i], NULL, divide_x_image, &divide_x_args[i]);
-    	}
-    	for(i = 0; i < NUM_THREADS_X; i++) {
-        	pthread_join(child_reflect_x[i], NULL);
-    	}
-		offset += data_len;
+	if (pool_nodes == 1) {
+		memset(buf, 0, bytes);
+		return;
+	}
+	for (node = 0; node < pool_nodes; node++) {
+		start = node == 0 ? 0 : (bytes * node / pool_nodes) & ~(size_t)4095;
+		end = node == pool_nodes - 1 ? bytes : (bytes * (node + 1) / pool_nodes) & ~(size_t)4095;
+		jobs[node].node = node;
+		jobs[node].dst = (char *)buf + start;
+		jobs[node].src = NULL;
+		jobs[node].bytes = end - start;
 	}
+	run_node_jobs(jobs);
+}
 
+/* Node holding image point (or dist_tx entry) point after zero_on_nodes */
+int point_node(int point)
+{
+	return (int)((long long)point * pool_nodes / (pts_r * sls_t * sls_p));
 }
 
+/* Remove range i of dq, dq->lock held */
+static void deque_remove(pool_deque *dq, int i)
+{
+	memmove(&dq->ranges[i], &dq->ranges[i + 1], (dq->count - i - 1) * sizeof(pool_range));
+	dq->count--;
+}
 
-void allocate_space()
+static void deque_push(pool_deque *dq, pool_batch *batch, int first, int end)
 {
-	
-	/* Allocate space for data */
-	rx_x = (float*) malloc(trans_x * trans_y * sizeof(float));
-	if (rx_x == NULL) fprintf(stderr, "Bad malloc on rx_x\n");
-	rx_y = (float*) malloc(trans_x * trans_y * sizeof(float));
-	if (rx_y == NULL) fprintf(stderr, "Bad malloc on rx_y\n");
-	rx_data = (float*) malloc(data_len * trans_x * trans_y * sizeof(float));
-	if (rx_data == NULL) fprintf(stderr, "Bad malloc on rx_data\n");
-
-	point_x = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
-	if (point_x == NULL) fprintf(stderr, "Bad malloc on point_x\n");
-	point_y = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
-	if (point_y == NULL) fprintf(stderr, "Bad malloc on point_y\n");
-	point_z = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
-	if (point_z == NULL) fprintf(stderr, "Bad malloc on point_z\n");
-
-	dist_tx = (float*) malloc(pts_r * sls_t * sls_p * sizeof(float));
-	if (dist_tx == NULL) fprintf(stderr, "Bad malloc on dist_tx\n");
+	pthread_mutex_lock(&dq->lock);
+	if (dq->count == dq->cap) {
+		dq->cap = dq->cap ? 2 * dq->cap : 8;
+		dq->ranges = (pool_range *) realloc(dq->ranges, dq->cap * sizeof(pool_range));
+		if (dq->ranges == NULL) {
+			fprintf(stderr, "Bad malloc on pool deque\n");
+			exit(-1);
+		}
+	}
+	dq->ranges[dq->count].batch = batch;
+	dq->ranges[dq->count].next = first;
+	dq->ranges[dq->count].end = end;
+	dq->count++;
+	pthread_mutex_unlock(&dq->lock);
+}
 
-	image = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
-	if (image == NULL) fprintf(stderr, "Bad malloc on image\n");
-	memset(image, 0, pts_r * sls_t * sls_p * sizeof(float));
+/* Workers the current plan runs on besides the caller: its thread count less one,
+ * within the pool */
+static int pool_share()
+{
+	int threads = num_threads > 0 ? num_threads : pool.cores;
 
+	return threads - 1 < pool.num_threads ? threads - 1 : pool.num_threads;
 }
 
-void read_binary(FILE *input)
+/* Whether the calling thread may take tasks of batch: the caller's slot always, a
+ * worker only inside the share of the plan that started it */
+static inline int pool_may_run(const pool_batch *batch)
 {
-	/* Load data from binary */
-	fread(rx_x, sizeof(float), trans_x * trans_y, input); 
-	fread(rx_y, sizeof(float), trans_x * trans_y, input); 
+	return worker_slot >= pool.num_threads || worker_slot < batch->workers;
+}
 
-	fread(point_x, sizeof(float), pts_r * sls_t * sls_p, input); 
-	fread(point_y, sizeof(float), pts_r * sls_t * sls_p, input); 
-	fread(point_z, sizeof(float), pts_r * sls_t * sls_p, input); 
+/* Owner side: next task of the newest range (of batch only, if set) */
+static pool_batch *deque_take(pool_deque *dq, pool_batch *only, int *task)
+{
+	pool_batch *batch = NULL;
+	int i;
 
-	fread(rx_data, sizeof(float), data_len * trans_x * trans_y, input); 
-	fclose(input);
+	pthread_mutex_lock(&dq->lock);
+	for (i = dq->count - 1; i >= 0; i--) {
+		if ((only != NULL && dq->ranges[i].batch != only) || !pool_may_run(dq->ranges[i].batch))
+			continue;
+		batch = dq->ranges[i].batch;
+		*task = dq->ranges[i].next++;
+		if (dq->ranges[i].next == dq->ranges[i].end)
+			deque_remove(dq, i);
+		break;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return batch;
 }
 
-int main (int argc, char **argv) {
+/* Thief side: split the back half off the oldest range of victim (of batch only, if
+ * set), run its first task here and queue the rest on the thief's own deque. Taking
+ * half keeps neighbouring tiles together and the number of steals logarithmic. */
+static pool_batch *deque_steal(pool_deque *victim, pool_batch *only, int *task)
+{
+	pool_batch *batch = NULL;
+	int i, first, end;
 
-	size = atoi(argv[1]);
+	if (__atomic_load_n(&victim->count, __ATOMIC_RELAXED) == 0)
+		return NULL;
+	pthread_mutex_lock(&victim->lock);
+	for (i = 0; i < victim->count; i++) {
+		if ((only != NULL && victim->ranges[i].batch != only) || !pool_may_run(victim->ranges[i].batch))
+			continue;
+		batch = victim->ranges[i].batch;
+		end = victim->ranges[i].end;
+		first = victim->ranges[i].next + (end - victim->ranges[i].next) / 2;
+		victim->ranges[i].end = first;
+		if (victim->ranges[i].next == first)
+			deque_remove(victim, i);
+		break;
+	}
+	pthread_mutex_unlock(&victim->lock);
 
+	if (batch != NULL) {
+		*task = first;
+		if (first + 1 < end)
+			deque_push(&pool.deques[worker_slot], batch, first + 1, end);
+		__sync_fetch_and_add(&pool.steals, 1);
+	}
+	return batch;
+}
 
+/* Claim a task for the calling thread: from its own deque, else by stealing from the
+ * other threads, those on the same NUMA node first. */
+static pool_batch *pool_claim(pool_batch *only, int *task)
+{
+	pool_batch *batch;
+	int slots = pool.num_threads + 1;
+	int pass, i, victim;
 
-	/* Variables for image space points */
-	sls_t = size; // Number of scanlines in theta
-	sls_p = size; // Number of scanlines in phi
-	total_angles = sls_p * sls_t;
+	batch = deque_take(&pool.deques[worker_slot], only, task);
+	for (pass = 0; batch == NULL && pass < (pool_nodes > 1 ? 2 : 1); pass++) {
+		for (i = 1; batch == NULL && i < slots; i++) {
+			victim = (worker_slot + i) % slots;
+			if ((pool.slot_nodes[victim] == worker_node) == (pass == 0))
+				batch = deque_steal(&pool.deques[victim], only, task);
+		}
+	}
+	if (batch != NULL) {
+		__sync_fetch_and_add(&batch->claimed, 1);
+		__sync_fetch_and_sub(&pool.queued, 1);
+	}
+	return batch;
+}
 
-	allocate_space();
+static void pool_execute(pool_batch *batch, int task)
+{
+	int count = batch->count; // batch may be gone once done reaches count
 
+	// Take on the state of the plan that queued the task, unless this thread has it already
+	if (batch->state_id != worker_state) {
+		plan_state_load(batch->state);
+		worker_state = batch->state_id;
+	}
+	busy_pause();
+	task_depth++;
+	task_start = now_usec();
+	batch->fn(batch->args + task * batch->stride);
+	busy_pause();
+	task_depth--;
+	busy_resume();
 
-    FILE* input;
-    FILE* output;
+	if (__sync_add_and_fetch(&batch->done, 1) == count) {
+		pthread_mutex_lock(&pool.lock);
+		pthread_cond_broadcast(&pool.work_done);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
 
-	// read cmd line input
-		if (argc < 1 || !(strcmp(argv[1],"16") || strcmp(argv[1],"32") || strcmp(argv[1],"64"))) {
-				printf("Usage: %s {16|32|64}\n",argv[0]);
-				fflush(stdout);
-				exit(-1);
+static void *pool_worker(void *arg)
+{
+	pool_batch *batch;
+	int task, idle;
+
+	worker_slot = (int)(long) arg;
+	if (numa_mode)
+		pin_to_node(pool.slot_nodes[worker_slot], worker_slot);
+	if (perf_mode) {
+		perf_open_thread();
+		pthread_mutex_lock(&pool.lock);
+		perf_ready++;
+		pthread_cond_broadcast(&pool.work_done);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	for (;;) {
+		batch = pool_claim(NULL, &task);
+		if (batch != NULL) {
+			pool_execute(batch, task);
+			continue;
 		}
-		char buff[128];
-			#ifdef __MIC__
-		sprintf(buff, "/beamforming_input_%s.bin", argv[1]);
-			#else // !__MIC__
-		sprintf(buff, "/n/typhon/data1/home/eecs570/beamforming_input_%s.bin", argv[1]);
-			#endif
-		input = fopen(buff,"rb");
-		if (!input) {
-			printf("Unable to open input file %s.\n", buff);
-			fflush(stdout);
-			exit(-1);
-		}	
-	//
 
-	read_binary(input);
+		// Sleep only when nothing is queued; otherwise a stolen range is in flight
+		// between two deques and will show up in a moment
+		pthread_mutex_lock(&pool.lock);
+		if (pool.shutdown) {
+			pthread_mutex_unlock(&pool.lock);
+			return NULL;
+		}
+		idle = __atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0 || worker_slot >= pool.widest;
+		if (idle)
+			pthread_cond_wait(&pool.work_ready, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+		if (!idle)
+			sched_yield();
+	}
+}
 
+long online_cores()
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores < 1 ? 1 : cores;
+}
 
-	printf("Beginning computation\n");
-	fflush(stdout);
+/* Start threads - 1 workers (one per online core for threads <= 0); the calling
+ * thread is the last one and helps out in pool_run */
+void pool_init(int threads)
+{
+	int i;
 
-	
-	
-	
-	
+	if (threads <= 0) threads = (int)online_cores();
+	pool.num_threads = threads - 1;
+	pool.cores = (int)online_cores();
+	pool.in_flight = pool.widest = 0;
+	pool.queued = 0;
+	pool.shutdown = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work_ready, NULL);
+	pthread_cond_init(&pool.work_done, NULL);
 
-	
+	pool.threads = (pthread_t *) malloc((pool.num_threads + 1) * sizeof(pthread_t));
+	if (pool.threads == NULL) fprintf(stderr, "Bad malloc on pool.threads\n");
+	pool.deques = (pool_deque *) calloc(pool.num_threads + 1, sizeof(pool_deque));
+	pool.slot_nodes = (int *) malloc((pool.num_threads + 1) * sizeof(int));
+	if (pool.deques == NULL || pool.slot_nodes == NULL) {
+		fprintf(stderr, "Bad malloc on pool deques\n");
+		exit(-1);
+	}
+	for (i = 0; i <= pool.num_threads; i++) {
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+		// Workers go round the nodes in order, the caller sits on the last one
+		pool.slot_nodes[i] = i < pool.num_threads ? i * pool_nodes / (pool.num_threads + 1) : pool_nodes - 1;
+	}
 
-    int current_start, range;
-	int i = 0;
-	int j = 0;
+	if (perf_mode) {
+		perf_slots = pool.num_threads + 1;
+		perf_ready = 0;
+		perf_fd = malloc(perf_slots * sizeof(*perf_fd));
+		busy_usec = (uint64_t *) calloc(perf_slots, sizeof(uint64_t));
+		perf_mark = (uint64_t *) calloc(perf_slots * (PERF_EVENTS + 1), sizeof(uint64_t));
+		for (i = 0; i < PERF_PHASES; i++)
+			perf_phase[i] = (uint64_t *) calloc(perf_slots * (PERF_EVENTS + 1), sizeof(uint64_t));
+		if (perf_fd == NULL || busy_usec == NULL || perf_mark == NULL || perf_phase[PERF_PHASES - 1] == NULL) {
+			fprintf(stderr, "Bad malloc on perf counters\n");
+			exit(-1);
+		}
+		memset(perf_fd, -1, perf_slots * sizeof(*perf_fd));
+	}
 
-	// Transmit thread init
-	pthread_t transmit_threads[NUM_THREADS_TRANSMIT];
-	thread_args transmit_work_ranges[NUM_THREADS_TRANSMIT];
+	for (i = 0; i < pool.num_threads; i++)
+		pthread_create(&pool.threads[i], NULL, pool_worker, (void *)(long)i);
+	worker_slot = pool.num_threads; // The caller is the last thread
+	if (numa_mode)
+		pin_to_node(pool_nodes - 1, pool.num_threads);
+	if (perf_mode) {
+		perf_open_thread();
+		pthread_mutex_lock(&pool.lock);
+		while (perf_ready < pool.num_threads)
+			pthread_cond_wait(&pool.work_done, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
 
-    current_start = 0;
-    range = total_angles / NUM_THREADS_TRANSMIT;
-    for(i = 0; i < NUM_THREADS_TRANSMIT; i++) {
-        transmit_work_ranges[i].start = current_start;
-        transmit_work_ranges[i].end = current_start + range;
-        current_start += range;
-    }
-    transmit_work_ranges[NUM_THREADS_TRANSMIT-1].end = total_angles;
+/* Run fn over count argument structs and wait for all of them. Every thread's deque
+ * starts with one contiguous slice of the tasks (threads are ordered by node, so with
+ * --numa each node starts on its own share); idle threads steal from the others. The
+ * caller works on its own batch while waiting, so tasks may themselves call pool_run
+ * without deadlock. */
+void pool_run(void *(*fn)(void *), void *args, size_t stride, int count)
+{
+	pool_batch batch;
+	bf_plan state;
+	int workers = pool_share();
+	int task, slot, first, end;
 
-	// Reflect Thread init
-	pthread_t reflect_threads[NUM_THREADS_REFLECT];
-	thread_args reflect_work_ranges[NUM_THREADS_REFLECT];
-	float **temp_images = (float **)malloc(NUM_THREADS_REFLECT * sizeof(float *));
+	if (task_depth == 0)
+		worker_slot = pool.num_threads; // Any thread calling in from outside the pool is a caller
+	plan_state_store(&state);
 
+	batch.fn = fn;
+	batch.args = (char *) args;
+	batch.stride = stride;
+	batch.count = count;
+	batch.claimed = 0;
+	batch.done = 0;
+	batch.workers = workers;
+	batch.state = &state;
+	batch.state_id = __sync_add_and_fetch(&pool.batches, 1);
 
-	current_start = 0;
-    range = 1024 / NUM_THREADS_REFLECT;
-    for(i = 0; i < NUM_THREADS_REFLECT; i++) {
-        reflect_work_ranges[i].start = current_start;
-        reflect_work_ranges[i].end = current_start + range;
+	pthread_mutex_lock(&pool.lock);
+	pool.in_flight++;
+	if (workers > pool.widest)
+		pool.widest = workers;
+	pthread_mutex_unlock(&pool.lock);
 
-		temp_images[i] = (float *)malloc(pts_r * sls_t * sls_p * sizeof(float));
-		if (temp_images[i] == NULL) fprintf(stderr, "Bad malloc on temp_images[%d]\n", i);
-		memset(temp_images[i], 0, pts_r * sls_t * sls_p * sizeof(float));
+	// Slices for the plan's share of the workers, the last one for the caller
+	__sync_fetch_and_add(&pool.queued, count);
+	for (slot = 0; slot <= workers; slot++) {
+		first = (int)((long long)count * slot / (workers + 1));
+		end = (int)((long long)count * (slot + 1) / (workers + 1));
+		if (first < end)
+			deque_push(&pool.deques[slot < workers ? slot : pool.num_threads], &batch, first, end);
+	}
+	pthread_mutex_lock(&pool.lock);
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
 
-		reflect_work_ranges[i].image_temp = temp_images[i];
+	for (;;) {
+		if (pool_claim(&batch, &task) != NULL) {
+			pool_execute(&batch, task);
+		} else if (__atomic_load_n(&batch.claimed, __ATOMIC_SEQ_CST) < count) {
+			sched_yield(); // A stolen range of this batch is in flight
+		} else {
+			break;
+		}
+	}
 
-		current_start += range;
-    }
-    reflect_work_ranges[NUM_THREADS_REFLECT-1].end = 1024;
+	// Everything is handed out, wait for the tasks still running elsewhere
+	pthread_mutex_lock(&pool.lock);
+	busy_pause();
+	while (__atomic_load_n(&batch.done, __ATOMIC_SEQ_CST) < count)
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+	busy_resume();
+	if (--pool.in_flight == 0)
+		pool.widest = 0;
+	pthread_mutex_unlock(&pool.lock);
+}
 
-	
-	
+void pool_destroy()
+{
+	int i;
 
+	pthread_mutex_lock(&pool.lock);
+	pool.shutdown = 1;
+	pthread_cond_broadcast(&pool.work_ready);
+	pthread_mutex_unlock(&pool.lock);
 
+	for (i = 0; i < pool.num_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	for (i = 0; i <= pool.num_threads; i++) {
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].ranges);
+	}
+	free(pool.threads);
+	free(pool.deques);
+	free(pool.slot_nodes);
+	pool.threads = NULL;
 
+	if (perf_mode) {
+		for (i = 0; i < perf_slots * PERF_EVENTS; i++)
+			if (perf_fd[i / PERF_EVENTS][i % PERF_EVENTS] >= 0)
+				close(perf_fd[i / PERF_EVENTS][i % PERF_EVENTS]);
+		free(perf_fd);
+		free(busy_usec);
+		free(perf_mark);
+		for (i = 0; i < PERF_PHASES; i++)
+			free(perf_phase[i]);
+		perf_slots = 0;
+	}
+}
 
-	/* get start timestamp */
- 	struct timeval tv;
-	gettimeofday(&tv,NULL);
-	uint64_t start = tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
-	
-	/* --------------------------- COMPUTATION ------------------------------ */
-	for(i = 0; i < NUM_THREADS_TRANSMIT; i++) {
-        pthread_create(&transmit_threads[i], NULL, transmit_distance, &transmit_work_ranges[i]);
-    }
-    for(i = 0; i < NUM_THREADS_TRANSMIT; i++) {
-        pthread_join(transmit_threads[i], NULL);
-    }
+/* Make sure the pool can run plans of threads threads (one per online core for
+ * threads <= 0). It is started once with at least one thread per core and each plan
+ * runs on the first of them (pool_share), so it is only restarted to grow, with no
+ * batch running. --numa sizes it to the request instead: its node split is over all
+ * of the threads. */
+void pool_reserve(int threads)
+{
+	int cores = (int)online_cores();
 
+	if (threads <= 0) threads = cores;
+	if (!numa_mode && threads < cores) threads = cores;
+	if (pool.threads != NULL && (numa_mode ? threads - 1 != pool.num_threads : threads - 1 > pool.num_threads))
+		pool_destroy();
+	if (pool.threads == NULL)
+		pool_init(threads);
+}
 
-	gettimeofday(&tv,NULL);
-    uint64_t end_transmit = tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
-    uint64_t elapsed_transmit = end_transmit - start;
-
-
-	for(i = 0; i < NUM_THREADS_REFLECT; i++) {
-        pthread_create(&reflect_threads[i], NULL, reflect_distance, &reflect_work_ranges[i]);
-    }
-    for(i = 0; i < NUM_THREADS_REFLECT; i++) {
-        pthread_join(reflect_threads[i], NULL);
-    }
-
-	    // Combine temporary images into the final image
-    for (i = 0; i < NUM_THREADS_REFLECT; i++) {
-        for (j = 0; j < pts_r * sls_t * sls_p; j++) {
-            image[j] += temp_images[i][j];
-        }
-        free(temp_images[i]);
-    }
-	free(temp_images);
+/* IEEE half <-> float for the scalar paths, round to nearest even */
+static inline float half_to_float(uint16_t h)
+{
+	union { uint32_t u; float f; } v;
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
 
-	
+	if (exp == 0) {
+		v.f = mant * (1.0f / 16777216.0f); // Subnormal, mant * 2^-24
+		v.u |= sign;
+	} else if (exp == 31) {
+		v.u = sign | 0x7f800000 | (mant << 13);
+	} else {
+		v.u = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+	return v.f;
+}
 
-	/* --------------------------------------------------------------------- */
+uint16_t float_to_half(float f)
+{
+	union { float f; uint32_t u; } v;
+	uint16_t sign, half;
+	uint32_t mant, rem, halfway;
+	int exp, shift;
 
-	/* get elapsed time */
-    	gettimeofday(&tv,NULL);
-    	uint64_t end = tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
-    	uint64_t elapsed = end - start;
+	v.f = f;
+	sign = (v.u >> 16) & 0x8000;
+	exp = (int)((v.u >> 23) & 0xff) - 112;
+	mant = v.u & 0x7fffff;
 
-	printf("Transmit time (usec): %lld\n", elapsed_transmit);
-	printf("Reflect time (usec): %lld\n", end - end_transmit);
-	printf("@@@ Elapsed time (usec): %lld\n", elapsed);
-	printf("Processing complete.  Preparing output.\n");
-	fflush(stdout);
+	if (exp >= 31) // Overflow to inf, or inf/nan
+		return sign | 0x7c00 | (exp == 143 && mant ? 0x200 : 0);
+	if (exp <= 0) { // Subnormal or zero
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		shift = 14 - exp;
+		half = mant >> shift;
+		rem = mant & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
+	} else {
+		half = (exp << 10) | (mant >> 13);
+		rem = mant & 0x1fff;
+		halfway = 0x1000;
+	}
+	if (rem > halfway || (rem == halfway && (half & 1)))
+		half++; // A carry out of the mantissa correctly bumps the exponent
+	return sign | half;
+}
 
-	/* Write result to file */
-	char* out_filename;
-        #ifdef __MIC__
-	  out_filename = "/home/micuser/beamforming_output.bin";
-        #else // !__MIC__
-	  out_filename = "beamforming_output.bin";
-        #endif
-        output = fopen(out_filename,"wb");
-	fwrite(image, sizeof(float), pts_r * sls_t * sls_p, output); 
-	fclose(output);
+/* One sample of a receiver channel stored in format (rx_format, or a constant in the
+ * fixed-size kernels), widened to float */
+static inline float rx_sample(int format, const void *data, int index)
+{
+	if (format == RX_HALF)
+		return half_to_float(((const uint16_t *)data)[index]);
+	if (format == RX_INT16)
+		return ((const int16_t *)data)[index] * rx_scale;
+	return ((const float *)data)[index];
+}
 
-	printf("Output complete.\n");
-	fflush(stdout);
+#ifdef HAVE_X86_SIMD
+/* Vector versions of rx_sample. 16-bit samples are gathered as 32-bit words at a
+ * 2-byte scale (hence the padding after rx_compact) and the high half dropped. */
+static inline __attribute__((always_inline, target("avx2,f16c")))
+__m256 rx_gather_avx2(int format, const void *data, __m256i index)
+{
+	__m256i words;
+
+	if (format == RX_FLOAT)
+		return _mm256_i32gather_ps((const float *)data, index, 4);
+	words = _mm256_i32gather_epi32((const int *)data, index, 2);
+	if (format == RX_INT16)
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(words, 16), 16)),
+				_mm256_set1_ps(rx_scale));
+	words = _mm256_packus_epi32(_mm256_and_si256(words, _mm256_set1_epi32(0xffff)), words);
+	words = _mm256_permute4x64_epi64(words, 0x08); // Low halves of both 128-bit lanes
+	return _mm256_cvtph_ps(_mm256_castsi256_si128(words));
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+__m512 rx_gather_avx512(int format, __mmask16 mask, const void *data, __m512i index)
+{
+	__m512i words;
+
+	if (format == RX_FLOAT)
+		return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, index, data, 4);
+	words = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, index, data, 2);
+	if (format == RX_INT16)
+		return _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_srai_epi32(_mm512_slli_epi32(words, 16), 16)),
+				_mm512_set1_ps(rx_scale));
+	return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(words));
+}
+#endif
+
+/* Start of receiver it_rx's channel in the storage the kernels gather from */
+const void *rx_channel(int it_rx)
+{
+	if (rx_node_format == rx_format) {
+		size_t sample_bytes = rx_format == RX_FLOAT ? sizeof(float) : sizeof(uint16_t);
+		return (const char *)rx_node_data[worker_node] + (size_t)it_rx * data_len * sample_bytes;
+	}
+	if (rx_format == RX_FLOAT)
+		return rx_data + (size_t)it_rx * data_len;
+	return (const uint16_t *)rx_compact + (size_t)it_rx * data_len;
+}
+
+/* Bodies of the exact-distance kernels. The generic kernels below inline them with
+ * count and format from the caller; the fixed-size ones (FIXED_RX_KERNELS) inline
+ * them with both as constants, so every variant does exactly the same arithmetic. */
+static inline __attribute__((always_inline))
+void rx_sweep_scalar(int count, int format, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	int it_pt;
+	int index; // Index into transducer data
+	float x_comp; // Itermediate value for dist calc
+	float y_comp; // Itermediate value for dist calc
+	float z_comp; // Itermediate value for dist calc
+	float dist;
+
+	for (it_pt = 0; it_pt < count; it_pt++) {
+		x_comp = rx_pos_x - px[it_pt];
+		x_comp = x_comp * x_comp;
+		y_comp = rx_pos_y - py[it_pt];
+		y_comp = y_comp * y_comp;
+		z_comp = rx_z - pz[it_pt];
+		z_comp = z_comp * z_comp;
+
+		dist = dtx[it_pt] + (float)sqrt(x_comp + y_comp + z_comp);
+		index = (int)(dist/idx_const + filter_delay + 0.5);
+		acc[it_pt] += rx_sample(format, data, index);
+	}
+}
+
+void rx_kernel_scalar(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	rx_sweep_scalar(count, rx_format, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc);
+}
+
+#ifdef HAVE_X86_SIMD
+/* The vector kernels do the same float ops in the same order as the scalar one
+ * (no FMA contraction, see the pragma at the top, true division, correctly rounded sqrt)
+ * so the indices come out identical.
+ * The +0.5 is exact in float because dist/idx_const + filter_delay stays far below 2^22. */
+static inline __attribute__((always_inline, target("avx2,f16c")))
+void rx_sweep_avx2(int count, int format, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	__m256 vrx_x = _mm256_set1_ps(rx_pos_x);
+	__m256 vrx_y = _mm256_set1_ps(rx_pos_y);
+	__m256 vrx_z = _mm256_set1_ps(rx_z);
+	__m256 vidx_const = _mm256_set1_ps(idx_const);
+	__m256 vdelay = _mm256_set1_ps((float)filter_delay);
+	__m256 vhalf = _mm256_set1_ps(0.5f);
+	__m256 x_comp, y_comp, z_comp, dist;
+	__m256i index;
+	int it_pt;
+
+	for (it_pt = 0; it_pt + 8 <= count; it_pt += 8) {
+		x_comp = _mm256_sub_ps(vrx_x, _mm256_loadu_ps(px + it_pt));
+		x_comp = _mm256_mul_ps(x_comp, x_comp);
+		y_comp = _mm256_sub_ps(vrx_y, _mm256_loadu_ps(py + it_pt));
+		y_comp = _mm256_mul_ps(y_comp, y_comp);
+		z_comp = _mm256_sub_ps(vrx_z, _mm256_loadu_ps(pz + it_pt));
+		z_comp = _mm256_mul_ps(z_comp, z_comp);
+
+		dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(x_comp, y_comp), z_comp));
+		dist = _mm256_add_ps(_mm256_loadu_ps(dtx + it_pt), dist);
+		dist = _mm256_add_ps(_mm256_add_ps(_mm256_div_ps(dist, vidx_const), vdelay), vhalf);
+		index = _mm256_cvttps_epi32(dist);
+
+		_mm256_storeu_ps(acc + it_pt, _mm256_add_ps(_mm256_loadu_ps(acc + it_pt),
+				rx_gather_avx2(format, data, index)));
+	}
+	rx_sweep_scalar(count - it_pt, format, px + it_pt, py + it_pt, pz + it_pt, dtx + it_pt,
+			rx_pos_x, rx_pos_y, data, acc + it_pt);
+}
+
+__attribute__((target("avx2,f16c")))
+void rx_kernel_avx2(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	rx_sweep_avx2(count, rx_format, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc);
+}
+
+static inline __attribute__((always_inline, target("avx512f")))
+void rx_sweep_avx512(int count, int format, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	__m512 vrx_x = _mm512_set1_ps(rx_pos_x);
+	__m512 vrx_y = _mm512_set1_ps(rx_pos_y);
+	__m512 vrx_z = _mm512_set1_ps(rx_z);
+	__m512 vidx_const = _mm512_set1_ps(idx_const);
+	__m512 vdelay = _mm512_set1_ps((float)filter_delay);
+	__m512 vhalf = _mm512_set1_ps(0.5f);
+	__m512 x_comp, y_comp, z_comp, dist;
+	__m512i index;
+	int it_pt;
+
+	for (it_pt = 0; it_pt + 16 <= count; it_pt += 16) {
+		x_comp = _mm512_sub_ps(vrx_x, _mm512_loadu_ps(px + it_pt));
+		x_comp = _mm512_mul_ps(x_comp, x_comp);
+		y_comp = _mm512_sub_ps(vrx_y, _mm512_loadu_ps(py + it_pt));
+		y_comp = _mm512_mul_ps(y_comp, y_comp);
+		z_comp = _mm512_sub_ps(vrx_z, _mm512_loadu_ps(pz + it_pt));
+		z_comp = _mm512_mul_ps(z_comp, z_comp);
+
+		dist = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(x_comp, y_comp), z_comp));
+		dist = _mm512_add_ps(_mm512_loadu_ps(dtx + it_pt), dist);
+		dist = _mm512_add_ps(_mm512_add_ps(_mm512_div_ps(dist, vidx_const), vdelay), vhalf);
+		index = _mm512_cvttps_epi32(dist);
+
+		_mm512_storeu_ps(acc + it_pt, _mm512_add_ps(_mm512_loadu_ps(acc + it_pt),
+				rx_gather_avx512(format, 0xffff, data, index)));
+	}
+	rx_sweep_scalar(count - it_pt, format, px + it_pt, py + it_pt, pz + it_pt, dtx + it_pt,
+			rx_pos_x, rx_pos_y, data, acc + it_pt);
+}
+
+__attribute__((target("avx512f")))
+void rx_kernel_avx512(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc)
+{
+	rx_sweep_avx512(count, rx_format, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc);
+}
+#endif
+
+/* rx_kernel instances with the point count fixed at compile time, for float channels.
+ * They ignore their count argument; the callers only use them when it equals COUNT. */
+#ifdef HAVE_X86_SIMD
+#define FIXED_RX_KERNELS_SIMD(COUNT) \
+__attribute__((target("avx2,f16c"))) \
+static void rx_fixed_avx2_##COUNT(int count, const float *px, const float *py, const float *pz, \
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc) \
+{ \
+	(void)count; \
+	rx_sweep_avx2(COUNT, RX_FLOAT, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc); \
+} \
+__attribute__((target("avx512f"))) \
+static void rx_fixed_avx512_##COUNT(int count, const float *px, const float *py, const float *pz, \
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc) \
+{ \
+	(void)count; \
+	rx_sweep_avx512(COUNT, RX_FLOAT, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc); \
+}
+#define FIXED_RX_TABLE(COUNT) {rx_fixed_scalar_##COUNT, rx_fixed_avx2_##COUNT, rx_fixed_avx512_##COUNT}
+#else
+#define FIXED_RX_KERNELS_SIMD(COUNT)
+#define FIXED_RX_TABLE(COUNT) {rx_fixed_scalar_##COUNT, rx_fixed_scalar_##COUNT, rx_fixed_scalar_##COUNT}
+#endif
+
+#define FIXED_RX_KERNELS(COUNT) \
+static void rx_fixed_scalar_##COUNT(int count, const float *px, const float *py, const float *pz, \
+		const float *dtx, float rx_pos_x, float rx_pos_y, const void *data, float *acc) \
+{ \
+	(void)count; \
+	rx_sweep_scalar(COUNT, RX_FLOAT, px, py, pz, dtx, rx_pos_x, rx_pos_y, data, acc); \
+} \
+FIXED_RX_KERNELS_SIMD(COUNT)
+
+FIXED_RX_KERNELS(1560) // One scanline (pts_r), the receiver engine's unit of work
+FIXED_RX_KERNELS(2048) // One full tile at the default 16 scanlines x 128 radial points
+
+// Configurations with specialized kernels, matched on (size, pts_r, receivers). The
+// kernel tables are indexed by SIMD level; tile_count is the point count of a full
+// tile at the default --tile/--tile-len, which tiles every size below exactly.
+typedef struct kernel_spec{
+	int size;
+	int pts_r;
+	int num_rx;
+	int tile_count;
+	rx_kernel_fn scan_kernels[3];
+	rx_kernel_fn tile_kernels[3];
+}kernel_spec;
+
+static const kernel_spec kernel_specs[] = {
+	{16, 1560, 1024, 2048, FIXED_RX_TABLE(1560), FIXED_RX_TABLE(2048)},
+	{32, 1560, 1024, 2048, FIXED_RX_TABLE(1560), FIXED_RX_TABLE(2048)},
+	{64, 1560, 1024, 2048, FIXED_RX_TABLE(1560), FIXED_RX_TABLE(2048)},
+};
+
+/* Symmetric kernels: the exact-distance arithmetic of rx_sweep_*, with each index
+ * gathered from every mirror's channel into that mirror's accumulator */
+void rx_sym_kernel_scalar(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, int mirrors, const void **data, float **acc)
+{
+	int it_pt, m;
+	int index; // Index into transducer data
+	float x_comp; // Itermediate value for dist calc
+	float y_comp; // Itermediate value for dist calc
+	float z_comp; // Itermediate value for dist calc
+	float dist;
+
+	for (it_pt = 0; it_pt < count; it_pt++) {
+		x_comp = rx_pos_x - px[it_pt];
+		x_comp = x_comp * x_comp;
+		y_comp = rx_pos_y - py[it_pt];
+		y_comp = y_comp * y_comp;
+		z_comp = rx_z - pz[it_pt];
+		z_comp = z_comp * z_comp;
+
+		dist = dtx[it_pt] + (float)sqrt(x_comp + y_comp + z_comp);
+		index = (int)(dist/idx_const + filter_delay + 0.5);
+		for (m = 0; m < mirrors; m++)
+			acc[m][it_pt] += rx_sample(rx_format, data[m], index);
+	}
+}
+
+/* Finish points it_pt..count-1 of a vector sym kernel with the scalar one */
+static void rx_sym_tail(int it_pt, int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, int mirrors, const void **data, float **acc)
+{
+	float *tail[4];
+	int m;
+
+	if (it_pt == count)
+		return;
+	for (m = 0; m < mirrors; m++)
+		tail[m] = acc[m] + it_pt;
+	rx_sym_kernel_scalar(count - it_pt, px + it_pt, py + it_pt, pz + it_pt, dtx + it_pt,
+			rx_pos_x, rx_pos_y, mirrors, data, tail);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2,f16c")))
+void rx_sym_kernel_avx2(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, int mirrors, const void **data, float **acc)
+{
+	__m256 vrx_x = _mm256_set1_ps(rx_pos_x);
+	__m256 vrx_y = _mm256_set1_ps(rx_pos_y);
+	__m256 vrx_z = _mm256_set1_ps(rx_z);
+	__m256 vidx_const = _mm256_set1_ps(idx_const);
+	__m256 vdelay = _mm256_set1_ps((float)filter_delay);
+	__m256 vhalf = _mm256_set1_ps(0.5f);
+	__m256 x_comp, y_comp, z_comp, dist;
+	__m256i index;
+	int it_pt, m;
+
+	for (it_pt = 0; it_pt + 8 <= count; it_pt += 8) {
+		x_comp = _mm256_sub_ps(vrx_x, _mm256_loadu_ps(px + it_pt));
+		x_comp = _mm256_mul_ps(x_comp, x_comp);
+		y_comp = _mm256_sub_ps(vrx_y, _mm256_loadu_ps(py + it_pt));
+		y_comp = _mm256_mul_ps(y_comp, y_comp);
+		z_comp = _mm256_sub_ps(vrx_z, _mm256_loadu_ps(pz + it_pt));
+		z_comp = _mm256_mul_ps(z_comp, z_comp);
+
+		dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(x_comp, y_comp), z_comp));
+		dist = _mm256_add_ps(_mm256_loadu_ps(dtx + it_pt), dist);
+		dist = _mm256_add_ps(_mm256_add_ps(_mm256_div_ps(dist, vidx_const), vdelay), vhalf);
+		index = _mm256_cvttps_epi32(dist);
+
+		for (m = 0; m < mirrors; m++)
+			_mm256_storeu_ps(acc[m] + it_pt, _mm256_add_ps(_mm256_loadu_ps(acc[m] + it_pt),
+					rx_gather_avx2(rx_format, data[m], index)));
+	}
+	rx_sym_tail(it_pt, count, px, py, pz, dtx, rx_pos_x, rx_pos_y, mirrors, data, acc);
+}
+
+__attribute__((target("avx512f")))
+void rx_sym_kernel_avx512(int count, const float *px, const float *py, const float *pz,
+		const float *dtx, float rx_pos_x, float rx_pos_y, int mirrors, const void **data, float **acc)
+{
+	__m512 vrx_x = _mm512_set1_ps(rx_pos_x);
+	__m512 vrx_y = _mm512_set1_ps(rx_pos_y);
+	__m512 vrx_z = _mm512_set1_ps(rx_z);
+	__m512 vidx_const = _mm512_set1_ps(idx_const);
+	__m512 vdelay = _mm512_set1_ps((float)filter_delay);
+	__m512 vhalf = _mm512_set1_ps(0.5f);
+	__m512 x_comp, y_comp, z_comp, dist;
+	__m512i index;
+	int it_pt, m;
+
+	for (it_pt = 0; it_pt + 16 <= count; it_pt += 16) {
+		x_comp = _mm512_sub_ps(vrx_x, _mm512_loadu_ps(px + it_pt));
+		x_comp = _mm512_mul_ps(x_comp, x_comp);
+		y_comp = _mm512_sub_ps(vrx_y, _mm512_loadu_ps(py + it_pt));
+		y_comp = _mm512_mul_ps(y_comp, y_comp);
+		z_comp = _mm512_sub_ps(vrx_z, _mm512_loadu_ps(pz + it_pt));
+		z_comp = _mm512_mul_ps(z_comp, z_comp);
+
+		dist = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(x_comp, y_comp), z_comp));
+		dist = _mm512_add_ps(_mm512_loadu_ps(dtx + it_pt), dist);
+		dist = _mm512_add_ps(_mm512_add_ps(_mm512_div_ps(dist, vidx_const), vdelay), vhalf);
+		index = _mm512_cvttps_epi32(dist);
+
+		for (m = 0; m < mirrors; m++)
+			_mm512_storeu_ps(acc[m] + it_pt, _mm512_add_ps(_mm512_loadu_ps(acc[m] + it_pt),
+					rx_gather_avx512(rx_format, 0xffff, data[m], index)));
+	}
+	rx_sym_tail(it_pt, count, px, py, pz, dtx, rx_pos_x, rx_pos_y, mirrors, data, acc);
+}
+#endif
+
+void table_kernel_scalar(int count, const uint16_t *off, int base, int mirrors, const void **data, float **acc)
+{
+	int i, m;
+
+	for (i = 0; i < count; i++)
+		for (m = 0; m < mirrors; m++)
+			acc[m][i] += rx_sample(rx_format, data[m], base + off[i]);
+}
+
+/* Finish points i..count-1 of a vector table kernel with the scalar one */
+static void table_tail(int i, int count, const uint16_t *off, int base, int mirrors, const void **data, float **acc)
+{
+	float *tail[4];
+	int m;
+
+	if (i == count)
+		return;
+	for (m = 0; m < mirrors; m++)
+		tail[m] = acc[m] + i;
+	table_kernel_scalar(count - i, off + i, base, mirrors, data, tail);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2,f16c")))
+void table_kernel_avx2(int count, const uint16_t *off, int base, int mirrors, const void **data, float **acc)
+{
+	__m256i vbase = _mm256_set1_epi32(base);
+	__m256i index;
+	int i, m;
+
+	for (i = 0; i + 8 <= count; i += 8) {
+		index = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(off + i))), vbase);
+		for (m = 0; m < mirrors; m++)
+			_mm256_storeu_ps(acc[m] + i, _mm256_add_ps(_mm256_loadu_ps(acc[m] + i),
+					rx_gather_avx2(rx_format, data[m], index)));
+	}
+	table_tail(i, count, off, base, mirrors, data, acc);
+}
+
+__attribute__((target("avx512f")))
+void table_kernel_avx512(int count, const uint16_t *off, int base, int mirrors, const void **data, float **acc)
+{
+	__m512i vbase = _mm512_set1_epi32(base);
+	__m512i index;
+	int i, m;
+
+	for (i = 0; i + 16 <= count; i += 16) {
+		index = _mm512_add_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(off + i))), vbase);
+		for (m = 0; m < mirrors; m++)
+			_mm512_storeu_ps(acc[m] + i, _mm512_add_ps(_mm512_loadu_ps(acc[m] + i),
+					rx_gather_avx512(rx_format, 0xffff, data[m], index)));
+	}
+	table_tail(i, count, off, base, mirrors, data, acc);
+}
+#endif
+
+/* Resolve --simd against what the CPU actually supports, falling back to scalar */
+void select_rx_kernel()
+{
+	int mode = SIMD_SCALAR;
+	int i;
+
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	// Auto stays on AVX2: the 512-bit gathers measure slower here, the autotuner tries them
+	if (__builtin_cpu_supports("avx512f") && simd_mode == SIMD_AVX512)
+		mode = SIMD_AVX512;
+	else if (__builtin_cpu_supports("avx2") && simd_mode != SIMD_SCALAR)
+		mode = SIMD_AVX2;
+#endif
+
+	switch (mode) {
+#ifdef HAVE_X86_SIMD
+	case SIMD_AVX512:
+		rx_kernel = rx_kernel_avx512; table_kernel = table_kernel_avx512;
+		rx_sym_kernel = rx_sym_kernel_avx512;
+		break;
+	case SIMD_AVX2:
+		rx_kernel = rx_kernel_avx2; table_kernel = table_kernel_avx2;
+		rx_sym_kernel = rx_sym_kernel_avx2;
+		break;
+#endif
+	default:
+		rx_kernel = rx_kernel_scalar; table_kernel = table_kernel_scalar;
+		rx_sym_kernel = rx_sym_kernel_scalar;
+		break;
+	}
+	simd_mode = mode;
+
+	// Fixed-size kernels when this configuration has them, generic ones otherwise
+	spec = NULL;
+	for (i = 0; specialize && rx_format == RX_FLOAT && i < (int)(sizeof(kernel_specs) / sizeof(kernel_specs[0])); i++)
+		if (kernel_specs[i].size == size && sls_t == size && sls_p == size && kernel_specs[i].pts_r == pts_r &&
+				kernel_specs[i].num_rx == trans_x * trans_y)
+			spec = &kernel_specs[i];
+	if (spec != NULL) {
+		scan_kernel = spec->scan_kernels[mode];
+		tile_kernel = spec->tile_kernels[mode];
+	}
+}
+
+const char *simd_name(int mode)
+{
+	return mode == SIMD_AVX512 ? "avx512" : mode == SIMD_AVX2 ? "avx2" : "scalar";
+}
+
+/* Specialization the reflect kernels run with, e.g. "64x64x1560/1024rx" or "generic" */
+const char *spec_name()
+{
+	static __thread char name[64];
+
+	if (spec == NULL)
+		return "generic";
+	snprintf(name, sizeof(name), "%dx%dx%d/%drx", spec->size, spec->size, spec->pts_r, spec->num_rx);
+	return name;
+}
+
+/* Write count parametric points starting at image point first into x/y/z */
+void generate_points(int first, int count, float *x, float *y, float *z)
+{
+	int scan = first / pts_r;
+	int it_r = first % pts_r;
+	int i, r;
+
+	for (i = 0; i < count; i++) {
+		r = radial_offset + it_r * radial_stride;
+		x[i] = (float)(scan_x0[scan] + r * scan_dx[scan]);
+		y[i] = (float)(scan_y0[scan] + r * scan_dy[scan]);
+		z[i] = (float)(scan_z0[scan] + r * scan_dz[scan]);
+		if (++it_r == pts_r) {
+			it_r = 0;
+			scan++;
+		}
+	}
+}
+
+/* Gather count stored points of a progressive pass starting at image point first */
+void gather_points(int first, int count, float *x, float *y, float *z)
+{
+	int scan = first / pts_r;
+	int it_r = first % pts_r;
+	int i;
+	size_t point;
+
+	for (i = 0; i < count; i++) {
+		point = (size_t)scan * geometry_r + radial_offset + (size_t)it_r * radial_stride;
+		x[i] = point_x[point];
+		y[i] = point_y[point];
+		z[i] = point_z[point];
+		if (++it_r == pts_r) {
+			it_r = 0;
+			scan++;
+		}
+	}
+}
+
+/* Point coordinates for image points first..first+count. Stored geometry hands back
+ * pointers into point_x/y/z; parametric geometry, and the stored points of a
+ * progressive pass, fill scratch (3 * count floats). */
+void get_points(int first, int count, float *scratch, float **x, float **y, float **z)
+{
+	if (geometry_mode == GEOMETRY_PARAM || radial_stride != 1) {
+		*x = scratch;
+		*y = scratch + count;
+		*z = scratch + 2 * count;
+		if (geometry_mode == GEOMETRY_PARAM)
+			generate_points(first, count, *x, *y, *z);
+		else
+			gather_points(first, count, *x, *y, *z);
+	} else {
+		*x = point_x + first;
+		*y = point_y + first;
+		*z = point_z + first;
+	}
+}
+
+int mirror_rx(int it_rx, int axis)
+{
+	int i = it_rx / trans_y, j = it_rx % trans_y;
+
+	return axis == SYM_X ? (trans_x - 1 - i) * trans_y + j : i * trans_y + (trans_y - 1 - j);
+}
+
+int mirror_scan(int scan, int axis)
+{
+	int t = scan / sls_p, p = scan % sls_p;
+
+	return axis == SYM_X ? (sls_t - 1 - t) * sls_p + p : t * sls_p + (sls_p - 1 - p);
+}
+
+/* Whether the geometry is exactly invariant under one mirror: the transmitter sits
+ * on the mirror plane and every receiver and scanline point maps onto its partner
+ * with the mirrored coordinate negated and the others bit-for-bit equal. Squaring
+ * drops the sign, so dist_tx, the receive distances and the indices all match. */
+int geometry_mirrored(int axis, float *scratch)
+{
+	float *ax, *ay, *az, *bx, *by, *bz;
+	float *a_mirror, *a_same, *b_mirror, *b_same;
+	int it_rx, scan, partner, it_r;
+
+	if ((axis == SYM_X ? tx_x : tx_y) != 0)
+		return 0;
+	for (it_rx = 0; it_rx < trans_x * trans_y; it_rx++) {
+		partner = mirror_rx(it_rx, axis);
+		if (axis == SYM_X ? rx_x[partner] != -rx_x[it_rx] || rx_y[partner] != rx_y[it_rx] :
+				rx_y[partner] != -rx_y[it_rx] || rx_x[partner] != rx_x[it_rx])
+			return 0;
+	}
+	for (scan = 0; scan < total_angles; scan++) {
+		partner = mirror_scan(scan, axis);
+		if (partner < scan)
+			continue;
+		get_points(scan * pts_r, pts_r, scratch, &ax, &ay, &az);
+		get_points(partner * pts_r, pts_r, scratch + 3 * pts_r, &bx, &by, &bz);
+		a_mirror = axis == SYM_X ? ax : ay; a_same = axis == SYM_X ? ay : ax;
+		b_mirror = axis == SYM_X ? bx : by; b_same = axis == SYM_X ? by : bx;
+		for (it_r = 0; it_r < pts_r; it_r++)
+			if (b_mirror[it_r] != -a_mirror[it_r] || b_same[it_r] != a_same[it_r] || bz[it_r] != az[it_r])
+				return 0;
+	}
+	return 1;
+}
+
+/* Find the mirrors of the current plan's geometry, once at plan creation */
+void detect_symmetry()
+{
+	float *scratch = (float *) malloc(6 * pts_r * sizeof(float));
+
+	sym_axes = 0;
+	if (scratch == NULL) {
+		fprintf(stderr, "Bad malloc on symmetry scratch\n");
+		return;
+	}
+	if (geometry_mirrored(SYM_X, scratch))
+		sym_axes |= SYM_X;
+	if (geometry_mirrored(SYM_Y, scratch))
+		sym_axes |= SYM_Y;
+	free(scratch);
+}
+
+/* Mirrors the reflect pass can use with the current settings. The mirrored receivers
+ * must be beamformed too. */
+int symmetry_mirrors()
+{
+	if (!symmetry || num_rx != trans_x * trans_y)
+		return 0;
+	return sym_axes;
+}
+
+const char *symmetry_name(int mirrors)
+{
+	return mirrors == (SYM_X | SYM_Y) ? "x+y" : mirrors == SYM_X ? "x" : mirrors == SYM_Y ? "y" : "none";
+}
+
+/* Flat index of the k-th scanline the reflect pass visits: rows t < sym_t, columns p < sym_p */
+int sym_scan(int k)
+{
+	return (k / sym_p) * sls_p + k % sym_p;
+}
+
+/* The (receiver, scanline) pairs whose receive distances equal those of (it_rx, scan)
+ * point for point under sym_mirrors, the pair itself first. A mirror that maps the
+ * scanline onto itself is left out: looping over every receiver already covers that
+ * pair. Returns how many pairs were written to rxs/scans, 1 to 4. */
+int sym_orbit(int it_rx, int scan, int *rxs, int *scans)
+{
+	int flip_x = (sym_mirrors & SYM_X) && mirror_scan(scan, SYM_X) != scan;
+	int flip_y = (sym_mirrors & SYM_Y) && mirror_scan(scan, SYM_Y) != scan;
+	int n = 0;
+
+	rxs[n] = it_rx; scans[n++] = scan;
+	if (flip_x) {
+		rxs[n] = mirror_rx(it_rx, SYM_X); scans[n++] = mirror_scan(scan, SYM_X);
+	}
+	if (flip_y) {
+		rxs[n] = mirror_rx(it_rx, SYM_Y); scans[n++] = mirror_scan(scan, SYM_Y);
+	}
+	if (flip_x && flip_y) {
+		rxs[n] = mirror_rx(mirror_rx(it_rx, SYM_X), SYM_Y);
+		scans[n++] = mirror_scan(mirror_scan(scan, SYM_X), SYM_Y);
+	}
+	return n;
+}
+
+/* Table version of the reflect kernel: radial points r..r+count-1 of the v-th visited
+ * scanline for receiver it_rx below table_live, into the orbit's data and acc */
+void table_segment(int it_rx, int v, int r, int count, int mirrors, const void **data, float **acc)
+{
+	size_t row = (size_t)it_rx * table_scans + v;
+
+	table_kernel(count, table_off + row * pts_r + r, table_base[row], mirrors, data, acc);
+}
+
+/* Fill the delay tables for receivers start..end with the exact index arithmetic */
+void *build_tables(void *arg)
+{
+	thread_args *thread_info = (struct thread_args *) arg;
+
+	int it_rx, v, it_r, point, min_index;
+	size_t row;
+	float x_comp, y_comp, z_comp, dist;
+	float *scan_x, *scan_y, *scan_z;
+	int *index = (int *) malloc(pts_r * sizeof(int));
+	float *scratch = (float *) malloc(3 * pts_r * sizeof(float));
+	if (index == NULL || scratch == NULL) fprintf(stderr, "Bad malloc on table scratch\n");
+
+	for (it_rx = thread_info->start; it_rx < thread_info->end; it_rx++) {
+		for (v = 0; v < table_scans; v++) {
+			point = sym_scan(v) * pts_r;
+			get_points(point, pts_r, scratch, &scan_x, &scan_y, &scan_z);
+			min_index = data_len;
+			for (it_r = 0; it_r < pts_r; it_r++) {
+				x_comp = rx_x[it_rx] - scan_x[it_r];
+				x_comp = x_comp * x_comp;
+				y_comp = rx_y[it_rx] - scan_y[it_r];
+				y_comp = y_comp * y_comp;
+				z_comp = rx_z - scan_z[it_r];
+				z_comp = z_comp * z_comp;
+
+				dist = dist_tx[point + it_r] + (float)sqrt(x_comp + y_comp + z_comp);
+				index[it_r] = (int)(dist/idx_const + filter_delay + 0.5);
+				if (index[it_r] < min_index) min_index = index[it_r];
+			}
+			// Indices stay inside one 12308-sample channel, so offsets always fit 16 bits
+			row = (size_t)it_rx * table_scans + v;
+			table_base[row] = min_index;
+			for (it_r = 0; it_r < pts_r; it_r++)
+				table_off[row * pts_r + it_r] = (uint16_t)(index[it_r] - min_index);
+		}
+	}
+	free(index);
+	free(scratch);
+	return NULL;
+}
+
+void free_tables()
+{
+	free(table_base);
+	free(table_off);
+	table_base = NULL;
+	table_off = NULL;
+	table_rx = 0;
+}
+
+// with 8 threads we are able to double performace for transmit distance
+void *transmit_distance(void *arg){
+
+	thread_args *thread_info = (struct thread_args *) arg;
+
+	/* First compute transmit distance */
+	int point;
+	int it_t; // Iterator for theta
+	int it_p; // Iterator for phi
+	int it_r; // Iterator for r
+
+	/* Variables for distance calculation and index conversion */
+	float x_comp; // Itermediate value for dist calc
+	float y_comp; // Itermediate value for dist calc
+	float z_comp; // Itermediate value for dist calc
+	int it_angle;
+	int r; // Radial point of the geometry, it_r unless this is a progressive pass
+	size_t geom; // Stored point of (it_angle, r)
+
+	point = thread_info->start * pts_r;
+
+	for(it_angle = thread_info->start; it_angle < thread_info->end; it_angle++) {
+		for (it_r = 0; it_r < pts_r; it_r++) {
+			r = radial_offset + it_r * radial_stride;
+
+			if (geometry_mode == GEOMETRY_PARAM) {
+				x_comp = tx_x - (float)(scan_x0[it_angle] + r * scan_dx[it_angle]);
+				y_comp = tx_y - (float)(scan_y0[it_angle] + r * scan_dy[it_angle]);
+				z_comp = tx_z - (float)(scan_z0[it_angle] + r * scan_dz[it_angle]);
+			} else {
+				geom = (size_t)it_angle * geometry_r + r;
+				x_comp = tx_x - point_x[geom];
+				y_comp = tx_y - point_y[geom];
+				z_comp = tx_z - point_z[geom];
+			}
+			x_comp = x_comp * x_comp;
+			y_comp = y_comp * y_comp;
+			z_comp = z_comp * z_comp;
+
+			dist_tx[point++] = (float)sqrt(x_comp + y_comp + z_comp);
+		}
+	}
+}
+
+void *divide_x_image(void *arg){
+	args_divide_x *thread_info = (struct args_divide_x *) arg;
+
+	int it_t; // Iterator for theta
+	int it_p; // Iterator for phi
+
+	int it_rx = thread_info->it_rx; // Iterator for recieve transducer
+
+	int point;
+	float *image_pos;
+	float *scan_x, *scan_y, *scan_z; // Coordinates of the current scanline
+	float *scratch = NULL;
+
+	if (geometry_mode == GEOMETRY_PARAM || radial_stride != 1) {
+		scratch = (float *) malloc(3 * pts_r * sizeof(float));
+		if (scratch == NULL) fprintf(stderr, "Bad malloc on scanline scratch\n");
+	}
+
+	for (it_t = thread_info->start; it_t < thread_info->end; it_t++) {    // whatever size is
+		point = it_t * sls_p * pts_r;
+		image_pos = thread_info->image_temp + point;
+		for (it_p = 0; it_p < sym_p; it_p++) { // whatever size is
+			// it_r loop over one scanline
+			if (sym_mirrors || it_rx < table_live) {
+				// One index per point feeds the whole orbit of (it_rx, this scanline)
+				int rxs[4], scans[4], mirrors, m;
+				const void *data[4];
+				float *acc[4];
+
+				mirrors = sym_orbit(it_rx, point / pts_r, rxs, scans);
+				for (m = 0; m < mirrors; m++) {
+					data[m] = rx_channel(rxs[m]);
+					acc[m] = thread_info->image_temp + scans[m] * pts_r;
+				}
+				if (it_rx < table_live) {
+					table_segment(it_rx, it_t * sym_p + it_p, 0, pts_r, mirrors, data, acc);
+				} else {
+					get_points(point, pts_r, scratch, &scan_x, &scan_y, &scan_z);
+					rx_sym_kernel(pts_r, scan_x, scan_y, scan_z, dist_tx + point,
+							rx_x[it_rx], rx_y[it_rx], mirrors, data, acc);
+				}
+			} else {
+				get_points(point, pts_r, scratch, &scan_x, &scan_y, &scan_z);
+				(spec != NULL ? scan_kernel : rx_kernel)(pts_r, scan_x, scan_y, scan_z, dist_tx + point,
+						rx_x[it_rx], rx_y[it_rx], rx_channel(it_rx), image_pos);
+			}
+			point += pts_r;
+			image_pos += pts_r;
+		}
+	}
+	free(scratch);
+}
+
+
+
+/* Sample window [lo, hi] of receiver it_rx that can be hit by points inside box
+ * (xmin, xmax, ymin, ymax, zmin, zmax) with transmit distances dtx_min..dtx_max.
+ * Nearest and farthest box points bound the receive leg; one sample of slack
+ * each side covers rounding. */
+void rx_window(const float *box, float dtx_min, float dtx_max, int it_rx, int *lo, int *hi)
+{
+	float q[3] = {rx_x[it_rx], rx_y[it_rx], rx_z};
+	float near = 0, far = 0, d;
+	int axis;
+
+	for (axis = 0; axis < 3; axis++) {
+		d = q[axis] < box[2 * axis] ? box[2 * axis] - q[axis] :
+				q[axis] > box[2 * axis + 1] ? q[axis] - box[2 * axis + 1] : 0;
+		near += d * d;
+		d = fabsf(q[axis] - box[2 * axis]) > fabsf(q[axis] - box[2 * axis + 1]) ?
+				q[axis] - box[2 * axis] : q[axis] - box[2 * axis + 1];
+		far += d * d;
+	}
+	*lo = (int)((dtx_min + sqrtf(near))/idx_const + filter_delay + 0.5) - 1;
+	*hi = (int)((dtx_max + sqrtf(far))/idx_const + filter_delay + 0.5) + 1;
+	if (*lo < 0) *lo = 0;
+	if (*hi > data_len - 1) *hi = data_len - 1;
+}
+
+/* Charge one tile's reflect traffic to the calling worker's node: the tile's coordinates,
+ * dist_tx and image slice once, plus every receiver's sample window. Local when the
+ * data sits on the worker's node, by the slicing of zero_on_nodes and replicate_rx. */
+void count_tile_traffic(int first, int count, uint64_t window_sum)
+{
+	uint64_t point_bytes = (uint64_t)count * 6 * sizeof(float);
+	uint64_t rx_bytes = window_sum * (rx_format == RX_FLOAT ? sizeof(float) : sizeof(uint16_t));
+
+	if (point_node(first) == worker_node)
+		__sync_fetch_and_add(&node_local_bytes[worker_node], point_bytes);
+	else
+		__sync_fetch_and_add(&node_remote_bytes[worker_node], point_bytes);
+	if (rx_node_format == rx_format || worker_node == 0)
+		__sync_fetch_and_add(&node_local_bytes[worker_node], rx_bytes);
+	else
+		__sync_fetch_and_add(&node_remote_bytes[worker_node], rx_bytes);
+}
+
+/* Pull samples lo..hi of a channel toward L1 ahead of its sweep */
+void prefetch_window(const void *channel, int lo, int hi)
+{
+	int sample_bytes = rx_format == RX_FLOAT ? sizeof(float) : sizeof(uint16_t);
+	const char *pos = (const char *)channel + (size_t)lo * sample_bytes;
+	const char *end = (const char *)channel + (size_t)(hi + 1) * sample_bytes;
+
+	for (; pos < end; pos += 64)
+		__builtin_prefetch(pos, 0, 3);
+}
+
+/* Sweep receivers rx_start..rx_end over one tile: the radial segment r_start..r_end
+ * of scanlines scan_start..scan_end. The tile's coordinates, dist_tx and accumulator
+ * stay in cache for the whole sweep instead of being streamed from DRAM once per
+ * receiver, and because the points sit at similar radius each receiver only touches
+ * a short window of its channel, which is prefetched one receiver ahead. */
+void *reflect_tile(void *arg){
+	args_tile *tile = (struct args_tile *) arg;
+
+	int it_rx; // Iterator for recieve transducer
+	int it_pt; // Iterator for point within tile
+	int first, k;
+
+	int len = tile->r_end - tile->r_start;
+	int scans = tile->scan_end - tile->scan_start;
+	int count = len * scans;
+	float *scan_x, *scan_y, *scan_z;
+	float box[6], dtx_min, dtx_max;
+	int lo, hi, next_lo, next_hi;
+	uint64_t window_sum = 0, sweeps = 0;
+	int rxs[4], orbit[4], mirrors, m, next_mirrors;
+	const void *data[4];
+	float *mirror_acc[4];
+
+	// Tile accumulator, followed by one per mirror image of the tile in symmetric passes
+	float *acc = (float *) calloc((size_t)count * (sym_mirrors ? 4 : 1), sizeof(float));
+	float *tile_pos = (float *) malloc(4 * count * sizeof(float)); // x, y, z and dist_tx, scanline-major
+	float *scratch = (float *) malloc(3 * len * sizeof(float));
+	if (acc == NULL || tile_pos == NULL || scratch == NULL) fprintf(stderr, "Bad malloc on tile buffers\n");
+	float *tile_x = tile_pos, *tile_y = tile_pos + count, *tile_z = tile_pos + 2 * count;
+	float *tile_tx = tile_pos + 3 * count;
+
+	// Gather the tile's points and find their bounding box and dist_tx range
+	box[0] = box[2] = box[4] = dtx_min = INFINITY;
+	box[1] = box[3] = box[5] = dtx_max = -INFINITY;
+	for (k = 0; k < scans; k++) {
+		first = sym_scan(tile->scan_start + k) * pts_r + tile->r_start;
+		get_points(first, len, scratch, &scan_x, &scan_y, &scan_z);
+		memcpy(tile_x + k * len, scan_x, len * sizeof(float));
+		memcpy(tile_y + k * len, scan_y, len * sizeof(float));
+		memcpy(tile_z + k * len, scan_z, len * sizeof(float));
+		memcpy(tile_tx + k * len, dist_tx + first, len * sizeof(float));
+	}
+	for (it_pt = 0; it_pt < count; it_pt++) {
+		box[0] = fminf(box[0], tile_x[it_pt]); box[1] = fmaxf(box[1], tile_x[it_pt]);
+		box[2] = fminf(box[2], tile_y[it_pt]); box[3] = fmaxf(box[3], tile_y[it_pt]);
+		box[4] = fminf(box[4], tile_z[it_pt]); box[5] = fmaxf(box[5], tile_z[it_pt]);
+		dtx_min = fminf(dtx_min, tile_tx[it_pt]); dtx_max = fmaxf(dtx_max, tile_tx[it_pt]);
+	}
+
+	// Mirrored receivers see the mirrored tile, so they share each receiver's window
+	rx_window(box, dtx_min, dtx_max, tile->rx_start, &next_lo, &next_hi);
+	next_mirrors = sym_orbit(tile->rx_start, sym_scan(tile->scan_start), rxs, orbit);
+	for (it_rx = tile->rx_start; it_rx < tile->rx_end; it_rx++) {
+		lo = next_lo;
+		hi = next_hi;
+		window_sum += (uint64_t)(hi - lo + 1) * next_mirrors;
+		sweeps += next_mirrors;
+		if (it_rx + 1 < tile->rx_end) {
+			rx_window(box, dtx_min, dtx_max, it_rx + 1, &next_lo, &next_hi);
+			next_mirrors = sym_orbit(it_rx + 1, sym_scan(tile->scan_start), rxs, orbit);
+			for (m = 0; m < next_mirrors; m++)
+				prefetch_window(rx_channel(rxs[m]), next_lo, next_hi);
+		}
+
+		if (sym_mirrors || it_rx < table_live) {
+			// Orbits differ between scanlines on and off the mirror planes. Receivers
+			// with delay tables need no geometry at all.
+			for (k = 0; k < scans; k++) {
+				mirrors = sym_orbit(it_rx, sym_scan(tile->scan_start + k), rxs, orbit);
+				for (m = 0; m < mirrors; m++) {
+					data[m] = rx_channel(rxs[m]);
+					mirror_acc[m] = acc + m * count + k * len;
+				}
+				if (it_rx < table_live)
+					table_segment(it_rx, tile->scan_start + k, tile->r_start, len, mirrors, data, mirror_acc);
+				else
+					rx_sym_kernel(len, tile_x + k * len, tile_y + k * len, tile_z + k * len, tile_tx + k * len,
+							rx_x[it_rx], rx_y[it_rx], mirrors, data, mirror_acc);
+			}
+		} else {
+			(spec != NULL && count == spec->tile_count ? tile_kernel : rx_kernel)(count,
+					tile_x, tile_y, tile_z, tile_tx, rx_x[it_rx], rx_y[it_rx],
+					rx_channel(it_rx), acc);
+		}
+	}
+
+	if (tile->lock != NULL)
+		pthread_mutex_lock(tile->lock);
+	for (k = 0; k < scans; k++) {
+		mirrors = sym_orbit(tile->rx_start, sym_scan(tile->scan_start + k), rxs, orbit);
+		for (m = 0; m < mirrors; m++) {
+			first = orbit[m] * pts_r + tile->r_start;
+			for (it_pt = 0; it_pt < len; it_pt++)
+				tile->image_temp[first + it_pt] += acc[m * count + k * len + it_pt];
+		}
+	}
+	if (tile->lock != NULL)
+		pthread_mutex_unlock(tile->lock);
+	__sync_fetch_and_add(&window_samples, window_sum);
+	count_tile_traffic(sym_scan(tile->scan_start) * pts_r + tile->r_start, count, window_sum);
+	__sync_fetch_and_add(&window_sweeps, sweeps);
+	free(acc);
+	free(tile_pos);
+	free(scratch);
+	return NULL;
+}
+
+/* Split the image into tiles of about tile_pts points: radial segments of tile_len
+ * points across enough neighbouring scanlines to fill the tile. When that gives fewer
+ * than STEAL_GRAIN tasks per thread (small sizes, many cores), the receivers are cut
+ * into chunks too, so the scheduler has enough pieces to balance to the end. Tasks
+ * are chunk-major: a thread's contiguous slice sweeps one receiver chunk over many tiles.
+ * Symmetric passes tile only the visited scanlines (sym_scan); each tile also owns its
+ * mirror images, which are disjoint from every other tile's, so the locks still suffice. */
+void reflect_tiles(int rx_start, int rx_end, float *image_temp)
+{
+	int len = tile_len < pts_r ? tile_len : pts_r;
+	int scans = tile_pts / len > 0 ? tile_pts / len : 1;
+	int visited = sym_t * sym_p; // Scanlines swept, all of them unless mirrors cover the rest
+	int scan_tiles = (visited + scans - 1) / scans;
+	int r_tiles = (pts_r + len - 1) / len;
+	int num_tiles = scan_tiles * r_tiles;
+	int target = STEAL_GRAIN * (pool_share() + 1);
+	int rx_chunks = (target + num_tiles - 1) / num_tiles;
+	int i, j, c;
+
+	if (rx_chunks > rx_end - rx_start) rx_chunks = rx_end - rx_start;
+	if (rx_chunks < 1) rx_chunks = 1;
+
+	args_tile *tiles = (args_tile *) malloc(rx_chunks * num_tiles * sizeof(args_tile));
+	pthread_mutex_t *locks = NULL;
+	if (tiles == NULL) fprintf(stderr, "Bad malloc on tiles\n");
+	if (rx_chunks > 1) {
+		locks = (pthread_mutex_t *) malloc(num_tiles * sizeof(pthread_mutex_t));
+		if (locks == NULL) fprintf(stderr, "Bad malloc on tile locks\n");
+		for (i = 0; i < num_tiles; i++)
+			pthread_mutex_init(&locks[i], NULL);
+	}
+
+	for (c = 0; c < rx_chunks; c++) {
+		for (i = 0; i < scan_tiles; i++) {
+			for (j = 0; j < r_tiles; j++) {
+				args_tile *tile = &tiles[(c * scan_tiles + i) * r_tiles + j];
+				tile->scan_start = i * scans;
+				tile->scan_end = (i + 1) * scans < visited ? (i + 1) * scans : visited;
+				tile->r_start = j * len;
+				tile->r_end = (j + 1) * len < pts_r ? (j + 1) * len : pts_r;
+				tile->rx_start = rx_start + (rx_end - rx_start) * c / rx_chunks;
+				tile->rx_end = rx_start + (rx_end - rx_start) * (c + 1) / rx_chunks;
+				tile->image_temp = image_temp;
+				tile->lock = locks != NULL ? &locks[i * r_tiles + j] : NULL;
+			}
+		}
+	}
+
+	pool_run(reflect_tile, tiles, sizeof(args_tile), rx_chunks * num_tiles);
+	if (locks != NULL) {
+		for (i = 0; i < num_tiles; i++)
+			pthread_mutex_destroy(&locks[i]);
+		free(locks);
+	}
+	free(tiles);
+}
+
+void *reflect_distance(void *arg){
+/* Now compute reflected distance, find index values, add to image */
+
+	thread_args *thread_info = (struct thread_args *) arg;
+
+	int it_rx; // Iterator for recieve transducer
+	int offset = 0;
+	float *image_temp = thread_info->image_temp;
+
+	if (reflect_engine == REFLECT_TILED) {
+		reflect_tiles(thread_info->start, thread_info->end, image_temp);
+		return NULL;
+	}
+
+	offset = thread_info->start * data_len;
+	for (it_rx = thread_info->start; it_rx < thread_info->end; it_rx++) {  // num_rx times
+
+		image_temp = thread_info->image_temp;
+
+		args_divide_x divide_x_args[x_tasks];
+
+		int i = 0;
+
+		// Theta slices of the visited rows differ by at most one row instead of the last taking the remainder
+		for(i = 0; i < x_tasks; i++) {
+			divide_x_args[i].start = sym_t * i / x_tasks;
+			divide_x_args[i].end = sym_t * (i + 1) / x_tasks;
+			divide_x_args[i].it_rx = it_rx;
+			divide_x_args[i].offset = offset;
+			divide_x_args[i].image_temp = image_temp;
+		}
+
+		pool_run(divide_x_image, divide_x_args, sizeof(args_divide_x), x_tasks);
+		offset += data_len;
+	}
+
+}
+
+/* dst[i] = parts[0][i] + ... + parts[n-1][i], summed in part order so the result
+ * matches adding the parts into a zeroed image one after another */
+void merge_scalar(float *dst, float **parts, int num_parts, int first, int count)
+{
+	int i, k;
+	float sum;
+
+	for (i = first; i < first + count; i++) {
+		sum = parts[0][i];
+		for (k = 1; k < num_parts; k++)
+			sum += parts[k][i];
+		dst[i] = sum;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/* The vector merges stream the sums past the cache: image is not read again
+ * until the output is written */
+__attribute__((target("avx2")))
+void merge_avx2(float *dst, float **parts, int num_parts, int first, int count)
+{
+	int head = (int)((32 - ((uintptr_t)(dst + first) & 31)) & 31) / sizeof(float);
+	int i, k;
+	__m256 sum;
+
+	if (((uintptr_t)dst & 3) || head > count)
+		head = count;
+	merge_scalar(dst, parts, num_parts, first, head);
+	for (i = first + head; i + 8 <= first + count; i += 8) {
+		sum = _mm256_loadu_ps(parts[0] + i);
+		for (k = 1; k < num_parts; k++)
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(parts[k] + i));
+		_mm256_stream_ps(dst + i, sum);
+	}
+	merge_scalar(dst, parts, num_parts, i, first + count - i);
+	_mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+void merge_avx512(float *dst, float **parts, int num_parts, int first, int count)
+{
+	int head = (int)((64 - ((uintptr_t)(dst + first) & 63)) & 63) / sizeof(float);
+	int i, k;
+	__m512 sum;
+
+	if (((uintptr_t)dst & 3) || head > count)
+		head = count;
+	merge_scalar(dst, parts, num_parts, first, head);
+	for (i = first + head; i + 16 <= first + count; i += 16) {
+		sum = _mm512_loadu_ps(parts[0] + i);
+		for (k = 1; k < num_parts; k++)
+			sum = _mm512_add_ps(sum, _mm512_loadu_ps(parts[k] + i));
+		_mm512_stream_ps(dst + i, sum);
+	}
+	merge_scalar(dst, parts, num_parts, i, first + count - i);
+	_mm_sfence();
+}
+#endif
+
+void *merge_images(void *arg)
+{
+	args_merge *range = (struct args_merge *) arg;
+	int count = range->end - range->start;
+
+	switch (simd_mode) {
+#ifdef HAVE_X86_SIMD
+	case SIMD_AVX512:
+		merge_avx512(image, range->parts, range->num_parts, range->start, count);
+		break;
+	case SIMD_AVX2:
+		merge_avx2(image, range->parts, range->num_parts, range->start, count);
+		break;
+#endif
+	default:
+		merge_scalar(image, range->parts, range->num_parts, range->start, count);
+		break;
+	}
+	return NULL;
+}
+
+
+void allocate_space()
+{
+	
+	/* Allocate space for data */
+	if (load_mode != LOAD_MMAP) {
+		rx_x = (float*) malloc(trans_x * trans_y * sizeof(float));
+		if (rx_x == NULL) fprintf(stderr, "Bad malloc on rx_x\n");
+		rx_y = (float*) malloc(trans_x * trans_y * sizeof(float));
+		if (rx_y == NULL) fprintf(stderr, "Bad malloc on rx_y\n");
+		rx_data = (float*) malloc(data_len * trans_x * trans_y * sizeof(float));
+		if (rx_data == NULL) fprintf(stderr, "Bad malloc on rx_data\n");
+
+		point_x = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
+		if (point_x == NULL) fprintf(stderr, "Bad malloc on point_x\n");
+		point_y = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
+		if (point_y == NULL) fprintf(stderr, "Bad malloc on point_y\n");
+		point_z = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
+		if (point_z == NULL) fprintf(stderr, "Bad malloc on point_z\n");
+	}
+
+	image = (float *) malloc(pts_r * sls_t * sls_p * sizeof(float));
+	if (image == NULL) fprintf(stderr, "Bad malloc on image\n");
+
+	// First touch decides page placement; the point arrays are placed when the plan copies them
+	zero_on_nodes(image, pts_r * sls_t * sls_p * sizeof(float));
+
+}
+
+void read_binary(FILE *input)
+{
+	/* Load data from binary */
+	fread(rx_x, sizeof(float), trans_x * trans_y, input); 
+	fread(rx_y, sizeof(float), trans_x * trans_y, input); 
+
+	fread(point_x, sizeof(float), pts_r * sls_t * sls_p, input); 
+	fread(point_y, sizeof(float), pts_r * sls_t * sls_p, input); 
+	fread(point_z, sizeof(float), pts_r * sls_t * sls_p, input); 
+
+	fread(rx_data, sizeof(float), data_len * trans_x * trans_y, input); 
+	fclose(input);
+}
+
+// --load=pipeline: the thread reading rx_data behind the plan setup and compute
+typedef struct rx_loader{
+	FILE *file;
+	long offset; // File position of rx_data
+	float *dest; // Frame the rows are read into, the command line's rx_data
+	int size; // For the short read message, size may be a plan's by then
+	rx_gate gate;
+	pthread_t thread;
+	uint64_t done; // now_usec when the last row landed
+}rx_loader;
+
+rx_loader loader;
+
+/* Read rx_data one mirror pair of receiver rows at a time, in the order reflect_arriving
+ * sweeps them, opening the gate a pair further after each */
+void *load_rx_rows(void *arg)
+{
+	rx_loader *load = (rx_loader *) arg;
+	size_t row_len = (size_t)trans_y * data_len;
+	int pairs = (trans_x + 1) / 2;
+	int k, m, rows[2], short_read = 0;
+
+	for (k = 0; k < pairs; k++) {
+		rows[0] = k;
+		rows[1] = trans_x - 1 - k;
+		for (m = 0; m < (rows[1] != k ? 2 : 1); m++) {
+			if (fseek(load->file, load->offset + (long)(rows[m] * row_len * sizeof(float)), SEEK_SET) != 0 ||
+					fread(load->dest + rows[m] * row_len, sizeof(float), row_len, load->file) != row_len)
+				short_read = 1;
+		}
+		pthread_mutex_lock(&load->gate.lock);
+		load->gate.pairs = k + 1;
+		pthread_cond_broadcast(&load->gate.changed);
+		pthread_mutex_unlock(&load->gate.lock);
+	}
+	if (short_read)
+		fprintf(stderr, "Input file is too short for size %d, rx_data is incomplete\n", load->size);
+	fclose(load->file);
+	load->done = now_usec();
+	return NULL;
+}
+
+/* Read the geometry and start load_rx_rows on the rest; the kernels wait on rx_arrival */
+void pipeline_binary(FILE *input)
+{
+	fread(rx_x, sizeof(float), trans_x * trans_y, input);
+	fread(rx_y, sizeof(float), trans_x * trans_y, input);
+
+	fread(point_x, sizeof(float), pts_r * sls_t * sls_p, input);
+	fread(point_y, sizeof(float), pts_r * sls_t * sls_p, input);
+	fread(point_z, sizeof(float), pts_r * sls_t * sls_p, input);
+
+	loader.file = input;
+	loader.offset = ftell(input);
+	loader.dest = rx_data;
+	loader.size = size;
+	loader.gate.frame = rx_data;
+	loader.gate.pairs = 0;
+	loader.gate.waited = 0;
+	pthread_mutex_init(&loader.gate.lock, NULL);
+	pthread_cond_init(&loader.gate.changed, NULL);
+	rx_arrival = &loader.gate;
+	pthread_create(&loader.thread, NULL, load_rx_rows, &loader);
+}
+
+/* Wait for the pipelined load to finish, after which rx_data is plain resident data */
+void finish_pipeline()
+{
+	if (rx_arrival == NULL)
+		return;
+	pthread_join(loader.thread, NULL);
+	rx_arrival = NULL;
+}
+
+/* Map the input file read-only and point rx_x, rx_y, point_x/y/z and rx_data
+ * straight into it, so nothing is copied before computation starts */
+void map_binary(FILE *input)
+{
+	struct stat st;
+	size_t rx_count = trans_x * trans_y;
+	size_t num_pts = (size_t)pts_r * sls_t * sls_p;
+	float *pos;
+	int flags = MAP_PRIVATE;
+
+	input_map_len = (2 * rx_count + 3 * num_pts + (size_t)data_len * rx_count) * sizeof(float);
+	if (fstat(fileno(input), &st) != 0 || (size_t)st.st_size < input_map_len) {
+		printf("Input file is too short for size %d.\n", size);
+		fflush(stdout);
+		exit(-1);
+	}
+
+#ifdef MAP_POPULATE
+	if (map_populate) flags |= MAP_POPULATE;
+#endif
+	input_map = mmap(NULL, input_map_len, PROT_READ, flags, fileno(input), 0);
+	if (input_map == MAP_FAILED) {
+		printf("Unable to map input file.\n");
+		fflush(stdout);
+		exit(-1);
+	}
+#ifdef MADV_HUGEPAGE
+	if (map_hugepages && madvise(input_map, input_map_len, MADV_HUGEPAGE) != 0)
+		fprintf(stderr, "madvise(MADV_HUGEPAGE) failed, continuing with base pages\n");
+#endif
+	fclose(input);
+
+	pos = (float *) input_map;
+	rx_x = pos; pos += rx_count;
+	rx_y = pos; pos += rx_count;
+	point_x = pos; pos += num_pts;
+	point_y = pos; pos += num_pts;
+	point_z = pos; pos += num_pts;
+	rx_data = pos;
+}
+
+/* Release the input arrays, whichever way they were loaded */
+void free_input()
+{
+	if (input_map != NULL) {
+		munmap(input_map, input_map_len);
+		input_map = NULL;
+	} else {
+		free(rx_x);
+		free(rx_y);
+		free(rx_data);
+		free(point_x);
+		free(point_y);
+		free(point_z);
+	}
+	rx_x = rx_y = rx_data = NULL;
+	point_x = point_y = point_z = NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2,f16c")))
+void float_to_half_f16c(const float *src, uint16_t *dst, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i *)(dst + i),
+				_mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+	for (; i < count; i++)
+		dst[i] = float_to_half(src[i]);
+}
+#endif
+
+/* Convert the channels of receivers start..end from rx_data into rx_compact */
+void *convert_channels(void *arg)
+{
+	thread_args *thread_info = (struct thread_args *) arg;
+	size_t first = (size_t)thread_info->start * data_len;
+	size_t count = (size_t)(thread_info->end - thread_info->start) * data_len;
+	int16_t *quant = (int16_t *)rx_compact + first;
+	uint16_t *half = (uint16_t *)rx_compact + first;
+	float inv_scale = 1 / rx_scale;
+	size_t i;
+
+	if (rx_format == RX_INT16) {
+		for (i = 0; i < count; i++)
+			quant[i] = (int16_t)lrintf(rx_data[first + i] * inv_scale);
+		return NULL;
+	}
+#ifdef HAVE_X86_SIMD
+	if (simd_mode != SIMD_SCALAR) {
+		float_to_half_f16c(rx_data + first, half, count);
+		return NULL;
+	}
+#endif
+	for (i = 0; i < count; i++)
+		half[i] = float_to_half(rx_data[first + i]);
+	return NULL;
+}
+
+/* Fill rx_compact from the current rx_data for the 16-bit formats. int16 uses
+ * one scale for the whole frame so the kernels need no per-channel factor. */
+void convert_rx()
+{
+	size_t total = (size_t)data_len * trans_x * trans_y;
+	int tasks = 4 * (pool_share() + 1);
+	float max_abs = 0;
+	size_t i;
+	int t;
+
+	if (rx_compact == NULL) {
+		rx_compact = calloc(total + 2, sizeof(uint16_t));
+		if (rx_compact == NULL) {
+			fprintf(stderr, "Bad malloc on rx_compact\n");
+			exit(-1);
+		}
+	}
+	if (rx_format == RX_INT16) {
+		for (i = 0; i < total; i++)
+			if (fabsf(rx_data[i]) > max_abs) max_abs = fabsf(rx_data[i]);
+		rx_scale = max_abs > 0 ? max_abs / 32767 : 1;
+	}
+
+	if (tasks > trans_x * trans_y) tasks = trans_x * trans_y;
+	thread_args ranges[tasks];
+	for (t = 0; t < tasks; t++) {
+		ranges[t].start = trans_x * trans_y * t / tasks;
+		ranges[t].end = trans_x * trans_y * (t + 1) / tasks;
+	}
+	pool_run(convert_channels, ranges, sizeof(thread_args), tasks);
+}
+
+/* Give every node its own copy of the channel storage in the current format, so
+ * reflect gathers never cross the interconnect */
+void replicate_rx()
+{
+	node_job jobs[MAX_NODES];
+	size_t sample_bytes = rx_format == RX_FLOAT ? sizeof(float) : sizeof(uint16_t);
+	size_t bytes = (size_t)data_len * trans_x * trans_y * sample_bytes;
+	int node;
+
+	if (pool_nodes == 1)
+		return;
+	for (node = 0; node < pool_nodes; node++) {
+		if (rx_node_data[node] == NULL) {
+			// Sized for float plus the 16-bit gather padding, so any format fits
+			rx_node_data[node] = malloc((size_t)data_len * trans_x * trans_y * sizeof(float) + 2 * sizeof(uint16_t));
+			if (rx_node_data[node] == NULL) {
+				fprintf(stderr, "Bad malloc on rx_data replica for node %d\n", node);
+				return;
+			}
+		}
+		jobs[node].node = node;
+		jobs[node].dst = (char *) rx_node_data[node];
+		jobs[node].src = rx_format == RX_FLOAT ? (const char *) rx_data : (const char *) rx_compact;
+		jobs[node].bytes = bytes;
+	}
+	run_node_jobs(jobs);
+	rx_node_format = rx_format;
+}
+
+const char *rx_format_name(int format)
+{
+	return format == RX_HALF ? "fp16" : format == RX_INT16 ? "int16" : "float";
+}
+
+/* Fit every scanline to origin + it_r * step and switch to parametric geometry, dropping
+ * point_x/y/z, if the model is good enough: in auto mode it has to regenerate every
+ * stored point bit for bit, since even a 1e-9 m deviation moves some sample indices
+ * across a rounding boundary; --geometry=param accepts up to geometry_tol. */
+void fit_geometry()
+{
+	int scan, it_r, point;
+	float x, y, z;
+	double dev, max_dev = 0;
+	double mean_r, var_r;
+	double sum_x, sum_y, sum_z, cov_x, cov_y, cov_z;
+
+	if (geometry_mode == GEOMETRY_STORED)
+		return;
+
+	scan_x0 = (double *) malloc(total_angles * sizeof(double));
+	scan_y0 = (double *) malloc(total_angles * sizeof(double));
+	scan_z0 = (double *) malloc(total_angles * sizeof(double));
+	scan_dx = (double *) malloc(total_angles * sizeof(double));
+	scan_dy = (double *) malloc(total_angles * sizeof(double));
+	scan_dz = (double *) malloc(total_angles * sizeof(double));
+	if (scan_x0 == NULL || scan_y0 == NULL || scan_z0 == NULL ||
+			scan_dx == NULL || scan_dy == NULL || scan_dz == NULL)
+		fprintf(stderr, "Bad malloc on scanline geometry\n");
+
+	// Least-squares line per scanline, so the float rounding of the endpoints does not skew the step
+	mean_r = (pts_r - 1) / 2.0;
+	var_r = 0;
+	for (it_r = 0; it_r < pts_r; it_r++)
+		var_r += (it_r - mean_r) * (it_r - mean_r);
+	if (var_r == 0) var_r = 1;
+
+	for (scan = 0; scan < total_angles; scan++) {
+		point = scan * pts_r;
+		sum_x = sum_y = sum_z = 0;
+		cov_x = cov_y = cov_z = 0;
+		for (it_r = 0; it_r < pts_r; it_r++) {
+			sum_x += point_x[point + it_r];
+			sum_y += point_y[point + it_r];
+			sum_z += point_z[point + it_r];
+			cov_x += (it_r - mean_r) * point_x[point + it_r];
+			cov_y += (it_r - mean_r) * point_y[point + it_r];
+			cov_z += (it_r - mean_r) * point_z[point + it_r];
+		}
+		scan_dx[scan] = cov_x / var_r;
+		scan_dy[scan] = cov_y / var_r;
+		scan_dz[scan] = cov_z / var_r;
+		scan_x0[scan] = sum_x / pts_r - mean_r * scan_dx[scan];
+		scan_y0[scan] = sum_y / pts_r - mean_r * scan_dy[scan];
+		scan_z0[scan] = sum_z / pts_r - mean_r * scan_dz[scan];
+
+		for (it_r = 0; it_r < pts_r; it_r++, point++) {
+			x = (float)(scan_x0[scan] + it_r * scan_dx[scan]);
+			y = (float)(scan_y0[scan] + it_r * scan_dy[scan]);
+			z = (float)(scan_z0[scan] + it_r * scan_dz[scan]);
+			dev = fabs(x - point_x[point]) + fabs(y - point_y[point]) + fabs(z - point_z[point]);
+			if (dev > max_dev) max_dev = dev;
+		}
+	}
+
+	if (max_dev > (geometry_mode == GEOMETRY_PARAM ? geometry_tol : 0)) {
+		if (geometry_mode == GEOMETRY_PARAM)
+			plan_note("Geometry: stored (points deviate %e m from parametric model, over the %e m limit)",
+					max_dev, geometry_tol);
+		else
+			plan_note("Geometry: stored (points deviate %e m from parametric model, --geometry=param to accept)",
+					max_dev);
+		geometry_mode = GEOMETRY_STORED;
+		free(scan_x0); free(scan_y0); free(scan_z0);
+		free(scan_dx); free(scan_dy); free(scan_dz);
+		return;
+	}
+
+	plan_note("Geometry: parametric (max deviation %e m)", max_dev);
+	geometry_mode = geometry_fit = GEOMETRY_PARAM;
+	if (keep_points)
+		return;
+	if (!borrowed_points) {
+		free(point_x);
+		free(point_y);
+		free(point_z);
+	}
+	point_x = point_y = point_z = NULL;
+}
+
+/* Nonzero while rx_data is the frame the pipelined load is still reading */
+int rx_arriving()
+{
+	return rx_arrival != NULL && rx_arrival->frame == rx_data;
+}
+
+/* Block until the first pairs row pairs of rx_data are resident */
+void rx_wait_pairs(int pairs)
+{
+	uint64_t start;
+
+	if (!rx_arriving())
+		return;
+	pthread_mutex_lock(&rx_arrival->lock);
+	if (rx_arrival->pairs < pairs) {
+		start = now_usec();
+		while (rx_arrival->pairs < pairs)
+			pthread_cond_wait(&rx_arrival->changed, &rx_arrival->lock);
+		rx_arrival->waited += now_usec() - start;
+	}
+	pthread_mutex_unlock(&rx_arrival->lock);
+}
+
+/* Owner-mode reflect pass while rx_data is still arriving: each block of row pairs is
+ * swept over the whole image as soon as it is resident. Every engine sums the same
+ * (receiver, point) pairs over any receiver range, and in symmetric passes a row's
+ * mirror images only read the mirrored row, which arrives with it. */
+void reflect_arriving(float *image_temp)
+{
+	int pairs = (trans_x + 1) / 2;
+	int step = pairs / 8 > 0 ? pairs / 8 : 1; // Row pairs per block
+	int k, end, mirror;
+	thread_args range;
+
+	range.image_temp = image_temp;
+	for (k = 0; k < pairs; k += step) {
+		if (__atomic_load_n(&rx_arrival->pairs, __ATOMIC_ACQUIRE) == pairs) {
+			// Everything has landed: rows k..trans_x-k-1 in one sweep
+			range.start = k * trans_y;
+			range.end = (trans_x - k) * trans_y;
+			reflect_distance(&range);
+			return;
+		}
+		end = k + step < pairs ? k + step : pairs;
+		rx_wait_pairs(end);
+		range.start = k * trans_y;
+		range.end = end * trans_y;
+		reflect_distance(&range);
+		// Mirrored rows trans_x-end..trans_x-k-1, less the middle row of an odd array
+		mirror = trans_x - end > end ? trans_x - end : end;
+		if (mirror < trans_x - k) {
+			range.start = mirror * trans_y;
+			range.end = (trans_x - k) * trans_y;
+			reflect_distance(&range);
+		}
+	}
+}
+
+/* Size the tables to table_mb and fill them from the current dist_tx, for the scanlines
+ * the current pass visits. Receivers are cached in array order until the budget runs
+ * out; the rest keep computing indices. Streaming the tables can cost more than the
+ * arithmetic they replace, so one reflect pass is timed with and one without them and
+ * they are dropped unless they win. */
+void prepare_tables()
+{
+	size_t per_rx = (size_t)sym_t * sym_p * (pts_r * sizeof(uint16_t) + sizeof(int32_t));
+	size_t budget = (size_t)table_mb << 20;
+	size_t image_bytes = (size_t)pts_r * sls_t * sls_p * sizeof(float);
+	uint64_t start = now_usec(), built, with, without;
+	thread_args probe;
+	int tasks, i;
+
+	tables_built = 1;
+	table_scans = sym_t * sym_p;
+	table_mirrors = sym_mirrors;
+	table_rx = (int)(budget / per_rx);
+	if (table_rx > trans_x * trans_y) table_rx = trans_x * trans_y;
+	if (table_rx == 0) {
+		plan_note("Delay tables: budget of %d MB is below one receiver (%zu MB)", table_mb, per_rx >> 20);
+		return;
+	}
+
+	table_base = (int32_t *) malloc((size_t)table_rx * table_scans * sizeof(int32_t));
+	table_off = (uint16_t *) malloc((size_t)table_rx * table_scans * pts_r * sizeof(uint16_t));
+	probe.image_temp = (float *) malloc(image_bytes);
+	if (table_base == NULL || table_off == NULL || probe.image_temp == NULL) {
+		fprintf(stderr, "Bad malloc on delay tables\n");
+		free_tables();
+		free(probe.image_temp);
+		return;
+	}
+
+	tasks = table_rx < 4 * (pool_share() + 1) ? table_rx : 4 * (pool_share() + 1);
+	thread_args ranges[tasks];
+	for (i = 0; i < tasks; i++) {
+		ranges[i].start = table_rx * i / tasks;
+		ranges[i].end = table_rx * (i + 1) / tasks;
+	}
+	pool_run(build_tables, ranges, sizeof(thread_args), tasks);
+	built = now_usec() - start;
+
+	probe.start = 0;
+	probe.end = num_rx;
+	rx_wait_pairs((trans_x + 1) / 2);
+	memset(probe.image_temp, 0, image_bytes);
+	start = now_usec();
+	reflect_distance(&probe);
+	without = now_usec() - start;
+	table_live = table_rx;
+	memset(probe.image_temp, 0, image_bytes);
+	start = now_usec();
+	reflect_distance(&probe);
+	with = now_usec() - start;
+	table_live = 0;
+	free(probe.image_temp);
+
+	plan_note("Delay tables: %d of %d receivers (%zu MB), built in %lld usec, reflect %lld usec with them against %lld without%s",
+			table_rx, trans_x * trans_y, (table_rx * per_rx) >> 20, (long long)built,
+			(long long)with, (long long)without, with < without ? "" : ", not used");
+	if (with >= without)
+		free_tables();
+}
+
+/* One full beamforming pass into image with the current settings */
+void compute_image(bf_times *times)
+{
+	int i = 0;
+	uint64_t start, end_transmit, end_reflect;
+
+	memset(image, 0, pts_r * sls_t * sls_p * sizeof(float));
+	window_samples = window_sweeps = 0;
+	memset(node_local_bytes, 0, sizeof(node_local_bytes));
+	memset(node_remote_bytes, 0, sizeof(node_remote_bytes));
+	pool.steals = 0;
+	sym_mirrors = symmetry_mirrors();
+	sym_t = sym_mirrors & SYM_X ? (sls_t + 1) / 2 : sls_t;
+	sym_p = sym_mirrors & SYM_Y ? (sls_p + 1) / 2 : sls_p;
+
+	// Transmit task init
+	thread_args transmit_work_ranges[transmit_tasks];
+
+	for(i = 0; i < transmit_tasks; i++) {
+		transmit_work_ranges[i].start = total_angles * i / transmit_tasks;
+		transmit_work_ranges[i].end = total_angles * (i + 1) / transmit_tasks;
+	}
+
+	// Reflect task init. In owner mode one group covers every receiver and its
+	// tiles (or theta slices) write straight into image, so there is nothing to merge.
+	int reflect_groups = (reduce_mode == REDUCE_OWNER) ? 1 : reflect_tasks;
+	thread_args reflect_work_ranges[reflect_groups];
+	float **temp_images = NULL;
+
+	if (reduce_mode == REDUCE_PRIVATE)
+		temp_images = (float **)malloc(reflect_groups * sizeof(float *));
+
+	for(i = 0; i < reflect_groups; i++) {
+		reflect_work_ranges[i].start = num_rx * i / reflect_groups;
+		reflect_work_ranges[i].end = num_rx * (i + 1) / reflect_groups;
+
+		if (reduce_mode == REDUCE_PRIVATE) {
+			temp_images[i] = (float *)malloc(pts_r * sls_t * sls_p * sizeof(float));
+			if (temp_images[i] == NULL) fprintf(stderr, "Bad malloc on temp_images[%d]\n", i);
+			zero_on_nodes(temp_images[i], pts_r * sls_t * sls_p * sizeof(float));
+
+			reflect_work_ranges[i].image_temp = temp_images[i];
+		} else {
+			reflect_work_ranges[i].image_temp = image;
+		}
+	}
+
+	// Delay tables are built once, outside the timed phases, from exact distances and for
+	// a full pass; short autotune runs leave them to the first real one
+	if (use_tables && !tables_built && num_rx == trans_x * trans_y) {
+		pool_run(transmit_distance, transmit_work_ranges, sizeof(thread_args), transmit_tasks);
+		prepare_tables();
+	}
+	table_live = use_tables && sym_mirrors == table_mirrors ? table_rx : 0;
+
+	if (perf_mode)
+		perf_boundary(-1);
+
+	/* get start timestamp */
+	start = now_usec();
+
+	/* --------------------------- COMPUTATION ------------------------------ */
+	if (!reuse_dist_tx)
+		pool_run(transmit_distance, transmit_work_ranges, sizeof(thread_args), transmit_tasks);
+	end_transmit = now_usec();
+	if (perf_mode)
+		perf_boundary(0);
+
+	if (rx_arriving() && reduce_mode == REDUCE_OWNER && num_rx == trans_x * trans_y) {
+		reflect_arriving(image);
+	} else {
+		rx_wait_pairs((trans_x + 1) / 2);
+		pool_run(reflect_distance, reflect_work_ranges, sizeof(thread_args), reflect_groups);
+	}
+	end_reflect = now_usec();
+	if (perf_mode)
+		perf_boundary(1);
+
+	// Combine temporary images into the final image: every worker sums all the
+	// partials over its own slice of the image in one pass
+	if (reduce_mode == REDUCE_PRIVATE) {
+		int total_pts = pts_r * sls_t * sls_p;
+		int merge_tasks = 4 * (pool_share() + 1);
+		args_merge merge_ranges[merge_tasks];
+
+		for (i = 0; i < merge_tasks; i++) {
+			// Slice edges on 64-byte multiples so only the ends need scalar code
+			merge_ranges[i].start = (int)((long long)total_pts * i / merge_tasks) & ~15;
+			merge_ranges[i].end = i + 1 < merge_tasks ? (int)((long long)total_pts * (i + 1) / merge_tasks) & ~15 : total_pts;
+			merge_ranges[i].parts = temp_images;
+			merge_ranges[i].num_parts = reflect_groups;
+		}
+		pool_run(merge_images, merge_ranges, sizeof(args_merge), merge_tasks);
+
+		for (i = 0; i < reflect_groups; i++)
+			free(temp_images[i]);
+		free(temp_images);
+	}
+	/* --------------------------------------------------------------------- */
+
+	times->transmit = end_transmit - start;
+	times->reflect = end_reflect - end_transmit;
+	times->merge = now_usec() - end_reflect;
+	if (perf_mode)
+		perf_boundary(2);
+}
+
+void save_config(engine_config *config)
+{
+	config->reflect_engine = reflect_engine;
+	config->reduce_mode = reduce_mode;
+	config->simd_mode = simd_mode;
+	config->geometry_mode = geometry_mode;
+	config->tile_pts = tile_pts;
+	config->transmit_tasks = transmit_tasks;
+	config->reflect_tasks = reflect_tasks;
+	config->x_tasks = x_tasks;
+	config->threads = num_threads;
+	config->use_tables = use_tables;
+	config->rx_format = rx_format;
+	config->specialize = specialize;
+	config->symmetry = symmetry;
+}
+
+void load_config(const engine_config *config)
+{
+	// A cached dist_tx only holds for the geometry mode it was made with
+	if (config->geometry_mode != geometry_mode)
+		reuse_dist_tx = 0;
+	reflect_engine = config->reflect_engine;
+	reduce_mode = config->reduce_mode;
+	simd_mode = config->simd_mode;
+	geometry_mode = config->geometry_mode;
+	tile_pts = config->tile_pts;
+	transmit_tasks = config->transmit_tasks;
+	reflect_tasks = config->reflect_tasks;
+	x_tasks = config->x_tasks;
+	use_tables = config->use_tables;
+	rx_format = config->rx_format;
+	specialize = config->specialize;
+	symmetry = config->symmetry;
+	num_threads = config->threads;
+	pool_reserve(num_threads);
+	select_rx_kernel();
+}
+
+// Taken shared around every run of a plan and exclusively to create or destroy one,
+// which may start, grow or stop the pool
+pthread_rwlock_t plan_lock = PTHREAD_RWLOCK_INITIALIZER;
+int live_plans = 0; // The pool is shut down with the last plan
+
+#define PLAN_SWAP(name) { __typeof__(name) swap_tmp = name; name = plan->name; plan->name = swap_tmp; }
+
+static void plan_swap(bf_plan *plan)
+{
+	int node;
+
+	PLAN_FIELDS(PLAN_SWAP)
+	for (node = 0; node < MAX_NODES; node++)
+		PLAN_SWAP(rx_node_data[node]);
+}
+
+/* Make plan the calling thread's configuration until plan_leave; the command line
+ * uses this to run its benchmark, autotune and check modes on a plan. Other plans
+ * can be entered on other threads meanwhile, this one waits for its last user. */
+void plan_enter(bf_plan *plan)
+{
+	pthread_mutex_lock(&plan->lock);
+	pthread_rwlock_rdlock(&plan_lock);
+	plan_swap(plan);
+	select_rx_kernel();
+}
+
+void plan_leave(bf_plan *plan)
+{
+	plan_swap(plan);
+	pthread_rwlock_unlock(&plan_lock);
+	pthread_mutex_unlock(&plan->lock);
+}
+
+/* Point the kernels at one frame of channel data, refreshing the 16-bit copy and
+ * the per-node replicas when the current plan uses them */
+void plan_load_frame(const float *frame)
+{
+	// A frame the loader is not reading retires the pipeline first
+	if (rx_arrival != NULL && rx_arrival->frame != frame)
+		finish_pipeline();
+	rx_data = (float *) frame;
+	if (shared_frame) // Converted and replicated already, by the plan that owns the copies
+		return;
+	// The 16-bit copy and the replicas are made from the whole frame
+	if (rx_format != RX_FLOAT || numa_mode)
+		rx_wait_pairs((trans_x + 1) / 2);
+	if (rx_format != RX_FLOAT)
+		convert_rx();
+	if (numa_mode)
+		replicate_rx();
+}
+
+/* Free what the current (entered) plan owns */
+static void plan_free_state()
+{
+	int node;
+
+	if (!shared_geometry) {
+		free(rx_x);
+		free(rx_y);
+		if (!borrowed_points) {
+			free(point_x);
+			free(point_y);
+			free(point_z);
+		}
+		if (geometry_fit == GEOMETRY_PARAM) {
+			free(scan_x0); free(scan_y0); free(scan_z0);
+			free(scan_dx); free(scan_dy); free(scan_dz);
+		}
+	}
+	free(dist_tx);
+	free(plan_notes);
+	if (table_rx > 0) {
+		free(table_base);
+		free(table_off);
+	}
+	if (shared_frame)
+		return;
+	free(rx_compact);
+	for (node = 0; node < MAX_NODES; node++)
+		free(rx_node_data[node]);
+}
+
+void bf_default_options(bf_options *options)
+{
+	options->reflect_engine = REFLECT_TILED;
+	options->reduce_mode = REDUCE_OWNER;
+	options->simd_mode = SIMD_AUTO;
+	options->geometry_mode = GEOMETRY_AUTO;
+	options->rx_format = RX_FLOAT;
+	options->specialize = 1;
+	options->symmetry = 1;
+	options->tile_pts = 2048;
+	options->tile_len = 128;
+	options->transmit_tasks = NUM_THREADS_TRANSMIT;
+	options->reflect_tasks = NUM_THREADS_REFLECT;
+	options->x_tasks = NUM_THREADS_X;
+	options->threads = 0;
+	options->table_mb = 0;
+	options->keep_points = 0;
+	options->borrow_points = 0;
+	options->roi_t_start = options->roi_t_end = 0;
+	options->roi_p_start = options->roi_p_end = 0;
+	options->roi_r_start = options->roi_r_end = 0;
+	options->r_step = 1;
+}
+
+/* Pack the region of interest of one full size x size x grid_r point array in place,
+ * in the order of the region's image: theta row, phi column, every r_step-th radial
+ * point. Each point moves to a lower index, so nothing is overwritten before it is read. */
+static void pack_region(float *points, const bf_options *options, int grid_r)
+{
+	int it_t, it_p, it_r;
+	float *dst = points;
+	const float *scan;
+
+	for (it_t = 0; it_t < sls_t; it_t++) {
+		for (it_p = 0; it_p < sls_p; it_p++) {
+			scan = points + ((size_t)(options->roi_t_start + it_t) * size + options->roi_p_start + it_p) * grid_r +
+					options->roi_r_start;
+			for (it_r = 0; it_r < pts_r; it_r++)
+				*dst++ = scan[(size_t)it_r * options->r_step];
+		}
+	}
+}
+
+/* Cut the current plan's full-grid geometry down to the region of interest. Stored
+ * points are packed; parametric scanlines keep the full grid's fit, moved to the
+ * region's first radial point and stretched by r_step, so the region's points (and
+ * image) match the same points of a full-volume plan. */
+static void crop_region(const bf_options *options, int t_end, int p_end, int r_end)
+{
+	int grid_r = pts_r;
+	int it_t, it_p, scan, from;
+
+	sls_t = t_end - options->roi_t_start;
+	sls_p = p_end - options->roi_p_start;
+	pts_r = (r_end - options->roi_r_start + options->r_step - 1) / options->r_step;
+	total_angles = sls_t * sls_p;
+
+	if (point_x != NULL && !borrowed_points) { // Borrowed points are always the whole grid
+		pack_region(point_x, options, grid_r);
+		pack_region(point_y, options, grid_r);
+		pack_region(point_z, options, grid_r);
+	}
+	if (geometry_fit != GEOMETRY_PARAM)
+		return;
+	for (it_t = 0, scan = 0; it_t < sls_t; it_t++) {
+		for (it_p = 0; it_p < sls_p; it_p++, scan++) {
+			from = (options->roi_t_start + it_t) * size + options->roi_p_start + it_p;
+			scan_x0[scan] = scan_x0[from] + options->roi_r_start * scan_dx[from];
+			scan_y0[scan] = scan_y0[from] + options->roi_r_start * scan_dy[from];
+			scan_z0[scan] = scan_z0[from] + options->roi_r_start * scan_dz[from];
+			scan_dx[scan] = scan_dx[from] * options->r_step;
+			scan_dy[scan] = scan_dy[from] * options->r_step;
+			scan_dz[scan] = scan_dz[from] * options->r_step;
+		}
+	}
+}
+
+bf_plan *bf_plan_create(int plan_size, const float *probe_x, const float *probe_y,
+		const float *grid_x, const float *grid_y, const float *grid_z, const bf_options *options)
+{
+	bf_plan *plan;
+	int grid_r = GRID_R; // Not pts_r: outside a plan that is whatever the calling thread had
+	int t_end = options->roi_t_end > 0 ? options->roi_t_end : plan_size;
+	int p_end = options->roi_p_end > 0 ? options->roi_p_end : plan_size;
+	int r_end = options->roi_r_end > 0 ? options->roi_r_end : grid_r;
+	size_t num_pts;
+	size_t num_probe = (size_t)trans_x * trans_y;
+
+	if (plan_size <= 0 || options->r_step <= 0)
+		return NULL;
+	// 0 means to the last row, column or point; below that is a bad region, not a default
+	if (options->roi_t_end < 0 || options->roi_p_end < 0 || options->roi_r_end < 0)
+		return NULL;
+	if (options->roi_t_start < 0 || options->roi_t_start >= t_end || t_end > plan_size ||
+			options->roi_p_start < 0 || options->roi_p_start >= p_end || p_end > plan_size ||
+			options->roi_r_start < 0 || options->roi_r_start >= r_end || r_end > grid_r)
+		return NULL;
+	plan = (bf_plan *) calloc(1, sizeof(bf_plan));
+	if (plan == NULL) {
+		fprintf(stderr, "Bad malloc on plan\n");
+		return NULL;
+	}
+
+	pthread_mutex_init(&plan->lock, NULL);
+
+	// Swap in the zeroed plan and fill in its state
+	pthread_rwlock_wrlock(&plan_lock);
+	plan_swap(plan);
+	size = plan_size;
+	sls_t = sls_p = size;
+	pts_r = grid_r;
+	total_angles = sls_t * sls_p;
+	num_pts = (size_t)pts_r * total_angles;
+	num_rx = trans_x * trans_y;
+	num_threads = options->threads;
+	reflect_engine = options->reflect_engine;
+	reduce_mode = options->reduce_mode;
+	simd_mode = options->simd_mode;
+	geometry_mode = options->geometry_mode;
+	geometry_fit = GEOMETRY_STORED;
+	keep_points = options->keep_points;
+	// Only the whole grid can be used in place; a region is packed into a copy
+	borrowed_points = options->borrow_points && options->roi_t_start == 0 && t_end == plan_size &&
+			options->roi_p_start == 0 && p_end == plan_size && options->roi_r_start == 0 &&
+			r_end == grid_r && options->r_step == 1;
+	tile_pts = options->tile_pts;
+	tile_len = options->tile_len;
+	transmit_tasks = options->transmit_tasks;
+	reflect_tasks = options->reflect_tasks;
+	x_tasks = options->x_tasks;
+	table_mb = options->table_mb;
+	use_tables = table_mb > 0;
+	rx_format = options->rx_format;
+	specialize = options->specialize;
+	symmetry = options->symmetry;
+	rx_node_format = -1;
+	rx_scale = 1;
+
+	rx_x = (float *) malloc(num_probe * sizeof(float));
+	rx_y = (float *) malloc(num_probe * sizeof(float));
+	if (borrowed_points) {
+		point_x = (float *) grid_x;
+		point_y = (float *) grid_y;
+		point_z = (float *) grid_z;
+	} else {
+		point_x = (float *) malloc(num_pts * sizeof(float));
+		point_y = (float *) malloc(num_pts * sizeof(float));
+		point_z = (float *) malloc(num_pts * sizeof(float));
+	}
+	if (rx_x == NULL || rx_y == NULL || point_x == NULL || point_y == NULL || point_z == NULL) {
+		fprintf(stderr, "Bad malloc on plan geometry\n");
+		plan_free_state();
+		plan_swap(plan);
+		pthread_rwlock_unlock(&plan_lock);
+		pthread_mutex_destroy(&plan->lock);
+		free(plan);
+		return NULL;
+	}
+	memcpy(rx_x, probe_x, num_probe * sizeof(float));
+	memcpy(rx_y, probe_y, num_probe * sizeof(float));
+	// Place the per-point arrays over the nodes before filling them; borrowed ones stay put
+	if (!borrowed_points) {
+		zero_on_nodes(point_x, num_pts * sizeof(float));
+		zero_on_nodes(point_y, num_pts * sizeof(float));
+		zero_on_nodes(point_z, num_pts * sizeof(float));
+		memcpy(point_x, grid_x, num_pts * sizeof(float));
+		memcpy(point_y, grid_y, num_pts * sizeof(float));
+		memcpy(point_z, grid_z, num_pts * sizeof(float));
+	}
+
+	// The geometry is fitted on the full grid, then only the region is kept
+	fit_geometry();
+	crop_region(options, t_end, p_end, r_end);
+	radial_offset = 0;
+	radial_stride = 1;
+	geometry_r = pts_r;
+	num_pts = (size_t)pts_r * total_angles;
+	dist_tx = (float *) malloc(num_pts * sizeof(float));
+	if (dist_tx == NULL) {
+		fprintf(stderr, "Bad malloc on plan geometry\n");
+		plan_free_state();
+		plan_swap(plan);
+		pthread_rwlock_unlock(&plan_lock);
+		pthread_mutex_destroy(&plan->lock);
+		free(plan);
+		return NULL;
+	}
+	zero_on_nodes(dist_tx, num_pts * sizeof(float));
+
+	pool_reserve(num_threads);
+	live_plans++;
+	select_rx_kernel();
+	if (simd_mode < options->simd_mode)
+		plan_note("Requested SIMD kernel not supported on this CPU, using %s", simd_name(simd_mode));
+	detect_symmetry();
+
+	plan_swap(plan);
+	pthread_rwlock_unlock(&plan_lock);
+	return plan;
+}
+
+void bf_execute(bf_plan *plan, const float *frame, float *out_image, bf_times *times)
+{
+	float *caller_rx_data, *caller_image;
+	bf_times run;
+	uint64_t start;
+
+	plan_enter(plan);
+	caller_rx_data = rx_data;
+	caller_image = image;
+
+	start = now_usec();
+	plan_load_frame(frame);
+	image = out_image;
+	run.prepare = now_usec() - start;
+	compute_image(&run);
+	reuse_dist_tx = 1;
+
+	rx_data = caller_rx_data;
+	image = caller_image;
+	plan_leave(plan);
+	if (times != NULL)
+		*times = run;
+}
+
+void bf_plan_destroy(bf_plan *plan)
+{
+	if (plan == NULL)
+		return;
+	pthread_rwlock_wrlock(&plan_lock);
+	plan_swap(plan);
+	plan_free_state();
+	plan_swap(plan);
+	if (--live_plans == 0)
+		pool_destroy();
+	pthread_rwlock_unlock(&plan_lock);
+	pthread_mutex_destroy(&plan->lock);
+	free(plan);
+}
+
+size_t bf_image_points(const bf_plan *plan)
+{
+	return (size_t)plan->pts_r * plan->sls_t * plan->sls_p;
+}
+
+void bf_plan_shape(const bf_plan *plan, int *theta, int *phi, int *radial)
+{
+	*theta = plan->sls_t;
+	*phi = plan->sls_p;
+	*radial = plan->pts_r;
+}
+
+size_t bf_frame_samples(void)
+{
+	return (size_t)data_len * trans_x * trans_y;
+}
+
+const char *bf_plan_kernel(const bf_plan *plan)
+{
+	return simd_name(plan->simd_mode);
+}
+
+const char *bf_plan_status(const bf_plan *plan)
+{
+	return plan->plan_notes != NULL ? plan->plan_notes : "";
+}
+
+struct bf_progressive{
+	int passes;
+	int sls_t, sls_p, pts_r; // Image of the whole region
+	bf_plan *region; // Holds the probe, the points and the fit the passes share
+	int own_region; // region was made for the passes (and is destroyed with them)
+	bf_plan **plans; // Plan of pass j beamforms radial points j, j + passes, ...
+	float *scratch; // Packed image of one pass
+	pthread_mutex_t lock; // One frame at a time: the passes share scratch and region's frame copies
+};
+
+/* Plan for every stride-th radial point of region's image from offset on. It shares
+ * region's geometry (which has to outlive it) and only gets its own transmit distances,
+ * and delay tables on first use; the frame's channel copies are region's as well,
+ * handed over by bf_progressive_execute. */
+static bf_plan *plan_radial_pass(const bf_plan *region, int offset, int stride)
+{
+	bf_plan *plan = (bf_plan *) malloc(sizeof(bf_plan));
+	size_t num_pts;
+	int node;
+
+	if (plan == NULL) {
+		fprintf(stderr, "Bad malloc on plan\n");
+		return NULL;
+	}
+	*plan = *region;
+	plan->radial_offset = offset;
+	plan->radial_stride = stride;
+	plan->geometry_r = region->pts_r;
+	plan->pts_r = (region->pts_r - offset + stride - 1) / stride;
+	plan->shared_geometry = 1;
+	plan->shared_frame = 1;
+	// Tiles keep the depth (and so the channel window) of the region's tiles
+	plan->tile_len = region->tile_len / stride > 16 ? region->tile_len / stride : 16;
+	plan->reuse_dist_tx = 0;
+	plan->tables_built = 0;
+	plan->table_rx = 0;
+	plan->table_live = 0;
+	plan->table_base = NULL;
+	plan->table_off = NULL;
+	plan->rx_compact = NULL;
+	plan->rx_node_format = -1;
+	for (node = 0; node < MAX_NODES; node++)
+		plan->rx_node_data[node] = NULL;
+	plan->plan_notes = NULL;
+	pthread_mutex_init(&plan->lock, NULL);
+
+	num_pts = (size_t)plan->pts_r * plan->total_angles;
+	pthread_rwlock_wrlock(&plan_lock);
+	plan->dist_tx = (float *) malloc(num_pts * sizeof(float));
+	if (plan->dist_tx == NULL) {
+		fprintf(stderr, "Bad malloc on plan geometry\n");
+		pthread_rwlock_unlock(&plan_lock);
+		pthread_mutex_destroy(&plan->lock);
+		free(plan);
+		return NULL;
+	}
+	zero_on_nodes(plan->dist_tx, num_pts * sizeof(float));
+	live_plans++;
+	pthread_rwlock_unlock(&plan_lock);
+	return plan;
+}
+
+/* Passes over region's image; with own_region they take region over, else it has
+ * to outlive them */
+static bf_progressive *progressive_passes(bf_plan *region, int own_region, int passes)
+{
+	bf_progressive *prog;
+	int j;
+
+	prog = (bf_progressive *) calloc(1, sizeof(bf_progressive));
+	if (prog == NULL) {
+		fprintf(stderr, "Bad malloc on progressive plan\n");
+		if (own_region)
+			bf_plan_destroy(region);
+		return NULL;
+	}
+	pthread_mutex_init(&prog->lock, NULL);
+	prog->region = region;
+	prog->own_region = own_region;
+	bf_plan_shape(region, &prog->sls_t, &prog->sls_p, &prog->pts_r);
+	if (passes > prog->pts_r)
+		passes = prog->pts_r;
+	prog->passes = passes;
+	prog->plans = (bf_plan **) calloc(passes, sizeof(bf_plan *));
+	if (prog->plans == NULL) {
+		fprintf(stderr, "Bad malloc on progressive plan\n");
+		bf_progressive_destroy(prog);
+		return NULL;
+	}
+
+	// Pass j starts j points out and steps over the other passes' points
+	for (j = 0; j < passes; j++) {
+		prog->plans[j] = plan_radial_pass(prog->region, j, passes);
+		if (prog->plans[j] == NULL) {
+			bf_progressive_destroy(prog);
+			return NULL;
+		}
+	}
+
+	prog->scratch = (float *) malloc(bf_image_points(prog->plans[0]) * sizeof(float));
+	if (prog->scratch == NULL) {
+		fprintf(stderr, "Bad malloc on progressive plan\n");
+		bf_progressive_destroy(prog);
+		return NULL;
+	}
+	return prog;
+}
+
+bf_progressive *bf_progressive_create(int plan_size, const float *probe_x, const float *probe_y,
+		const float *grid_x, const float *grid_y, const float *grid_z, const bf_options *options,
+		int passes)
+{
+	bf_plan *region;
+
+	if (passes <= 0)
+		return NULL;
+	// The region is copied and fitted once and never beamformed itself
+	region = bf_plan_create(plan_size, probe_x, probe_y, grid_x, grid_y, grid_z, options);
+	if (region == NULL)
+		return NULL;
+	free(region->dist_tx);
+	region->dist_tx = NULL;
+	return progressive_passes(region, 1, passes);
+}
+
+void bf_progressive_execute(bf_progressive *prog, const float *frame, float *out_image,
+		bf_publish_fn publish, void *user, bf_progress_times *times)
+{
+	int passes = prog->passes;
+	int total = prog->sls_t * prog->sls_p;
+	int j, scan, it_r, pass_t, pass_p, pass_r, node;
+	bf_plan *pass;
+	float *dst, *caller_rx_data;
+	const float *src;
+	uint64_t start = now_usec();
+	bf_progress_times run = {0, 0};
+
+	// The 16-bit copy and the node replicas are made once, on the region, for every pass
+	pthread_mutex_lock(&prog->lock);
+	plan_enter(prog->region);
+	caller_rx_data = rx_data;
+	plan_load_frame(frame);
+	rx_data = caller_rx_data;
+	plan_leave(prog->region);
+	for (j = 0; j < passes; j++) {
+		pass = prog->plans[j];
+		pass->rx_compact = prog->region->rx_compact;
+		pass->rx_scale = prog->region->rx_scale;
+		pass->rx_node_format = prog->region->rx_node_format;
+		for (node = 0; node < MAX_NODES; node++)
+			pass->rx_node_data[node] = prog->region->rx_node_data[node];
+	}
+
+	for (j = 0; j < passes; j++) {
+		bf_execute(prog->plans[j], frame, prog->scratch, NULL);
+		bf_plan_shape(prog->plans[j], &pass_t, &pass_p, &pass_r);
+
+		// Scatter the pass into its radial points, then hold it over the points of later passes
+		for (scan = 0; scan < total; scan++) {
+			dst = out_image + (size_t)scan * prog->pts_r;
+			src = prog->scratch + (size_t)scan * pass_r;
+			for (it_r = 0; it_r < pass_r; it_r++)
+				dst[it_r * passes + j] = src[it_r];
+			if (j + 1 < passes)
+				for (it_r = 0; it_r < prog->pts_r; it_r++)
+					if (it_r % passes > j)
+						dst[it_r] = dst[it_r - it_r % passes + j];
+		}
+
+		if (j == 0)
+			run.first = now_usec() - start;
+		if (j + 1 == passes)
+			run.final = now_usec() - start;
+		if (publish != NULL)
+			publish(user, out_image, j, passes);
+	}
+	pthread_mutex_unlock(&prog->lock);
+	if (times != NULL)
+		*times = run;
+}
+
+void bf_progressive_destroy(bf_progressive *prog)
+{
+	int j;
+
+	if (prog == NULL)
+		return;
+	for (j = 0; prog->plans != NULL && j < prog->passes; j++)
+		bf_plan_destroy(prog->plans[j]);
+	if (prog->own_region)
+		bf_plan_destroy(prog->region); // Last, the passes read its geometry
+	free(prog->plans);
+	free(prog->scratch);
+	pthread_mutex_destroy(&prog->lock);
+	free(prog);
+}
+
+#ifndef BEAMFORM_LIB // Command-line front end from here on
+
+/* Switch from the command-line settings to one of the benchmark variants:
+ *   og          serial receiver loop, as in beamform_og.c
+ *   outer_loop  8 receiver groups into private images, as in beamForm_outer_loop.c
+ *   beamform    the settings given on the command line
+ * Returns 0 for an unknown name. */
+int apply_variant(const char *name, const engine_config *cmdline)
+{
+	engine_config config = *cmdline;
+
+	if (!strcmp(name, "og") || !strcmp(name, "outer_loop")) {
+		config.reflect_engine = REFLECT_RECEIVER;
+		config.simd_mode = SIMD_SCALAR;
+		config.geometry_mode = GEOMETRY_STORED;
+		config.x_tasks = 1;
+		config.use_tables = 0;
+		config.rx_format = RX_FLOAT;
+		config.specialize = 0;
+		config.symmetry = 0;
+		if (!strcmp(name, "og")) {
+			config.reduce_mode = REDUCE_OWNER;
+			config.transmit_tasks = 1;
+		} else {
+			config.reduce_mode = REDUCE_PRIVATE;
+			config.transmit_tasks = 8;
+			config.reflect_tasks = 8;
+		}
+	} else if (strcmp(name, "beamform")) {
+		return 0;
+	}
+	load_config(&config);
+	return 1;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of n samples (sorts v) */
+uint64_t percentile(uint64_t *v, int n, double p)
+{
+	int rank = (int)ceil(p * n) - 1;
+
+	qsort(v, n, sizeof(uint64_t), compare_u64);
+	if (rank < 0) rank = 0;
+	if (rank > n - 1) rank = n - 1;
+	return v[rank];
+}
+
+/* Time every variant in bench_variants over bench_trials runs after bench_warmup
+ * untimed ones. Prints min/median/p95 per phase and one JSON line per variant. */
+void run_benchmark(uint64_t load_time)
+{
+	char list[256];
+	char *name, *save;
+	uint64_t *samples[4]; // transmit, reflect, merge, total
+	const char *phase_names[4] = {"transmit", "reflect", "merge", "total"};
+	uint64_t stat_min[4], stat_med[4], stat_p95[4];
+	bf_times times;
+	double num_pts = (double)pts_r * sls_t * sls_p;
+	double gflops, gbps;
+	engine_config cmdline;
+	int trial, phase;
+
+	save_config(&cmdline);
+
+	for (phase = 0; phase < 4; phase++) {
+		samples[phase] = (uint64_t *) malloc(bench_trials * sizeof(uint64_t));
+		if (samples[phase] == NULL) fprintf(stderr, "Bad malloc on benchmark samples\n");
+	}
+
+	snprintf(list, sizeof(list), "%s", bench_variants);
+	for (name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		if (!apply_variant(name, &cmdline)) {
+			printf("Unknown benchmark variant %s\n", name);
+			continue;
+		}
+
+		for (trial = 0; trial < bench_warmup; trial++)
+			compute_image(&times);
+		for (trial = 0; trial < bench_trials; trial++) {
+			compute_image(&times);
+			samples[0][trial] = times.transmit;
+			samples[1][trial] = times.reflect;
+			samples[2][trial] = times.merge;
+			samples[3][trial] = times.transmit + times.reflect + times.merge;
+		}
+
+		for (phase = 0; phase < 4; phase++) {
+			stat_min[phase] = percentile(samples[phase], bench_trials, 0);
+			stat_med[phase] = percentile(samples[phase], bench_trials, 0.5);
+			stat_p95[phase] = percentile(samples[phase], bench_trials, 0.95);
+		}
+		gflops = num_pts * (TX_FLOPS + num_rx * RX_FLOPS) / (stat_med[3] * 1e3);
+		gbps = num_pts * num_rx * RX_BYTES / (stat_med[3] * 1e3);
+
+		printf("Variant %s (%s kernel, %s sizes, symmetry %s, %d trials after %d warmup)\n", name,
+				simd_name(simd_mode), spec_name(), symmetry_name(symmetry_mirrors()), bench_trials, bench_warmup);
+		for (phase = 0; phase < 4; phase++)
+			printf("  %-8s min %10lld  median %10lld  p95 %10lld usec\n", phase_names[phase],
+					(long long)stat_min[phase], (long long)stat_med[phase], (long long)stat_p95[phase]);
+		printf("  load     %10lld usec\n", (long long)load_time);
+		printf("  %.2f GFLOP/s, %.2f GB/s naive-equivalent traffic\n", gflops, gbps);
+
+		printf("{\"variant\":\"%s\",\"size\":%d,\"kernel\":\"%s\",\"spec\":\"%s\",\"symmetry\":\"%s\",\"trials\":%d,\"warmup\":%d",
+				name, size, simd_name(simd_mode), spec_name(), symmetry_name(symmetry_mirrors()), bench_trials, bench_warmup);
+		for (phase = 0; phase < 4; phase++)
+			printf(",\"%s_us\":{\"min\":%lld,\"median\":%lld,\"p95\":%lld}", phase_names[phase],
+					(long long)stat_min[phase], (long long)stat_med[phase], (long long)stat_p95[phase]);
+		printf(",\"io_us\":%lld,\"gflops\":%.3f,\"gbps\":%.3f}\n", (long long)load_time, gflops, gbps);
+		fflush(stdout);
+	}
+
+	for (phase = 0; phase < 4; phase++)
+		free(samples[phase]);
+
+	load_config(&cmdline);
+}
+
+/* Cache lines are "host cores size engine reduce tile threads transmit reflect x";
+ * the last line matching this machine and size wins. Returns 1 if one was found. */
+int read_tune_cache(const char *host, engine_config *config)
+{
+	FILE *cache = fopen(tune_path, "r");
+	char line[512], line_host[256];
+	long line_cores;
+	int line_size, found = 0;
+	engine_config entry;
+
+	if (cache == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), cache) != NULL) {
+		if (sscanf(line, "%255s %ld %d %d %d %d %d %d %d %d", line_host, &line_cores, &line_size,
+				&entry.reflect_engine, &entry.reduce_mode, &entry.tile_pts, &entry.threads,
+				&entry.transmit_tasks, &entry.reflect_tasks, &entry.x_tasks) != 10)
+			continue;
+		if (strcmp(line_host, host) || line_cores != online_cores() || line_size != size)
+			continue;
+		entry.simd_mode = config->simd_mode;
+		entry.geometry_mode = config->geometry_mode;
+		entry.use_tables = config->use_tables;
+		entry.rx_format = config->rx_format;
+		entry.specialize = config->specialize;
+		entry.symmetry = config->symmetry;
+		*config = entry;
+		found = 1;
+	}
+	fclose(cache);
+	return found;
+}
+
+void write_tune_cache(const char *host, const engine_config *config)
+{
+	FILE *cache = fopen(tune_path, "a");
+
+	if (cache == NULL) {
+		printf("Unable to write tuning cache %s.\n", tune_path);
+		return;
+	}
+	fprintf(cache, "%s %ld %d %d %d %d %d %d %d %d\n", host, online_cores(), size,
+			config->reflect_engine, config->reduce_mode, config->tile_pts, config->threads,
+			config->transmit_tasks, config->reflect_tasks, config->x_tasks);
+	fclose(cache);
+}
+
+/* Time one short run (tune_receivers receivers) of the given decomposition */
+uint64_t time_candidate(const engine_config *config)
+{
+	bf_times times;
+	uint64_t best = 0;
+	int trial;
+
+	load_config(config);
+	for (trial = 0; trial < 2; trial++) {
+		compute_image(&times);
+		if (trial == 0 || times.transmit + times.reflect + times.merge < best)
+			best = times.transmit + times.reflect + times.merge;
+	}
+	return best;
+}
+
+/* Pick thread count, tile size and task decomposition for this machine and size,
+ * either from the cache or by timing candidates on a short run */
+void run_autotune()
+{
+	static const int tile_sizes[] = {512, 1024, 2048, 4096, 8192, 16384};
+	static const int task_scales[] = {1, 2, 4};
+	char host[256];
+	engine_config base, candidate, best;
+	uint64_t time, best_time = 0;
+	int cores = (int)online_cores();
+	int thread_opts[2], num_thread_opts;
+	int t, i, j;
+
+	if (gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "unknown");
+	host[sizeof(host) - 1] = '\0';
+
+	save_config(&base);
+	if (autotune == TUNE_CACHED && read_tune_cache(host, &base)) {
+		load_config(&base);
+		printf("Autotune: using cached settings from %s\n", tune_path);
+		return;
+	}
+
+	thread_opts[0] = cores;
+	thread_opts[1] = cores / 2;
+	num_thread_opts = cores > 1 ? 2 : 1;
+
+	num_rx = tune_receivers < trans_x * trans_y ? tune_receivers : trans_x * trans_y;
+	for (t = 0; t < num_thread_opts; t++) {
+		candidate = base;
+		candidate.threads = thread_opts[t];
+		candidate.transmit_tasks = 4 * thread_opts[t];
+
+		// Tiled engine, owner and private reduction over tile sizes
+		candidate.reflect_engine = REFLECT_TILED;
+		for (i = 0; i < (int)(sizeof(tile_sizes) / sizeof(tile_sizes[0])); i++) {
+			candidate.tile_pts = tile_sizes[i];
+			candidate.reduce_mode = REDUCE_OWNER;
+			time = time_candidate(&candidate);
+			if (best_time == 0 || time < best_time) { best_time = time; best = candidate; }
+
+			candidate.reduce_mode = REDUCE_PRIVATE;
+			for (j = 0; j < (int)(sizeof(task_scales) / sizeof(task_scales[0])); j++) {
+				candidate.reflect_tasks = task_scales[j] * thread_opts[t];
+				if (candidate.reflect_tasks > num_rx) continue;
+				time = time_candidate(&candidate);
+				if (time < best_time) { best_time = time; best = candidate; }
+			}
+		}
+
+		// Receiver engine with theta slices written in place
+		candidate.reflect_engine = REFLECT_RECEIVER;
+		candidate.reduce_mode = REDUCE_OWNER;
+		for (j = 0; j < (int)(sizeof(task_scales) / sizeof(task_scales[0])); j++) {
+			candidate.x_tasks = task_scales[j] * thread_opts[t];
+			if (candidate.x_tasks > sls_t) continue;
+			time = time_candidate(&candidate);
+			if (time < best_time) { best_time = time; best = candidate; }
+		}
+	}
+
+	// AVX-512 only where it beats the AVX2 kernels auto settles on
+#ifdef HAVE_X86_SIMD
+	if (base.simd_mode == SIMD_AVX2 && __builtin_cpu_supports("avx512f")) {
+		candidate = best;
+		candidate.simd_mode = SIMD_AVX512;
+		time = time_candidate(&candidate);
+		if (time < best_time) { best_time = time; best = candidate; }
+	}
+#endif
+	num_rx = trans_x * trans_y;
+
+	load_config(&best);
+	write_tune_cache(host, &best);
+	printf("Autotune: %s reflect, %s kernel, %s reduce, tile %d, %d threads, %d/%d/%d transmit/reflect/x tasks\n",
+			best.reflect_engine == REFLECT_TILED ? "tiled" : "receiver",
+			simd_name(best.simd_mode),
+			best.reduce_mode == REDUCE_OWNER ? "owner" : "private", best.tile_pts, best.threads,
+			best.transmit_tasks, best.reflect_tasks, best.x_tasks);
+}
+
+/* BEAMFORM_* environment defaults, applied before (and overridden by) the command line */
+void read_env()
+{
+	char *value;
+
+	if ((value = getenv("BEAMFORM_THREADS")) != NULL && atoi(value) > 0)
+		num_threads = atoi(value);
+	if ((value = getenv("BEAMFORM_TRANSMIT_TASKS")) != NULL && atoi(value) > 0)
+		transmit_tasks = atoi(value);
+	if ((value = getenv("BEAMFORM_REFLECT_TASKS")) != NULL && atoi(value) > 0)
+		reflect_tasks = atoi(value);
+	if ((value = getenv("BEAMFORM_X_TASKS")) != NULL && atoi(value) > 0)
+		x_tasks = atoi(value);
+	if ((value = getenv("BEAMFORM_TILE")) != NULL && atoi(value) > 0)
+		tile_pts = atoi(value);
+}
+
+char *output_filename()
+{
+	if (output_path != NULL)
+		return output_path;
+	#ifdef __MIC__
+	return "/home/micuser/beamforming_output.bin";
+	#else // !__MIC__
+	return "beamforming_output.bin";
+	#endif
+}
+
+/* Loader thread: fill the two frame slots alternately until the stream runs dry */
+void *load_frames(void *arg)
+{
+	frame_stream *stream = (frame_stream *) arg;
+	size_t frame_len = (size_t)data_len * trans_x * trans_y;
+	size_t got;
+	int slot = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&stream->lock);
+		while (stream->ready[slot])
+			pthread_cond_wait(&stream->changed, &stream->lock);
+		pthread_mutex_unlock(&stream->lock);
+
+		got = fread(stream->frames[slot], sizeof(float), frame_len, stream->file);
+
+		pthread_mutex_lock(&stream->lock);
+		if (got < frame_len) {
+			if (got > 0) fprintf(stderr, "Dropping partial frame of %zu samples\n", got);
+			stream->eof = 1;
+		} else {
+			stream->ready[slot] = 1;
+		}
+		pthread_cond_broadcast(&stream->changed);
+		pthread_mutex_unlock(&stream->lock);
+
+		if (stream->eof)
+			return NULL;
+		slot ^= 1;
+	}
+}
+
+/* Streaming mode: each rx_data frame from stream_path is run through the plan while
+ * the loader thread reads the next one, and each volume is appended to the output
+ * as soon as it completes. */
+void run_stream(bf_plan *plan)
+{
+	frame_stream stream;
+	pthread_t loader;
+	bf_times times;
+	FILE *output;
+	uint64_t start, elapsed;
+	int slot = 0;
+	int frames = 0;
+
+	if (!strcmp(stream_path, "-"))
+		stream.file = stdin;
+	else
+		stream.file = fopen(stream_path, "rb");
+	if (stream.file == NULL) {
+		printf("Unable to open stream %s.\n", stream_path);
+		fflush(stdout);
+		exit(-1);
+	}
+	output = fopen(output_filename(), "wb");
+	if (!output) {
+		printf("Unable to open output file %s.\n", output_filename());
+		fflush(stdout);
+		exit(-1);
+	}
+
+	stream.frames[0] = (float *) malloc((size_t)data_len * trans_x * trans_y * sizeof(float));
+	stream.frames[1] = (float *) malloc((size_t)data_len * trans_x * trans_y * sizeof(float));
+	if (stream.frames[0] == NULL || stream.frames[1] == NULL) fprintf(stderr, "Bad malloc on stream frames\n");
+	stream.ready[0] = stream.ready[1] = 0;
+	stream.eof = 0;
+	pthread_mutex_init(&stream.lock, NULL);
+	pthread_cond_init(&stream.changed, NULL);
+	pthread_create(&loader, NULL, load_frames, &stream);
+
+	start = now_usec();
+	for (;;) {
+		pthread_mutex_lock(&stream.lock);
+		while (!stream.ready[slot] && !stream.eof)
+			pthread_cond_wait(&stream.changed, &stream.lock);
+		pthread_mutex_unlock(&stream.lock);
+		if (!stream.ready[slot])
+			break;
+
+		bf_execute(plan, stream.frames[slot], image, &times);
+
+		fwrite(image, sizeof(float), bf_image_points(plan), output);
+		fflush(output);
+		printf("Frame %d: transmit %lld, reflect %lld, merge %lld usec\n", frames,
+				(long long)times.transmit, (long long)times.reflect, (long long)times.merge);
+		frames++;
+
+		pthread_mutex_lock(&stream.lock);
+		stream.ready[slot] = 0;
+		pthread_cond_broadcast(&stream.changed);
+		pthread_mutex_unlock(&stream.lock);
+		slot ^= 1;
+	}
+	elapsed = now_usec() - start;
+
+	pthread_join(loader, NULL);
+	if (stream.file != stdin)
+		fclose(stream.file);
+	fclose(output);
+	free(stream.frames[0]);
+	free(stream.frames[1]);
+
+	printf("@@@ Streamed %d volumes in %lld usec\n", frames, (long long)elapsed);
+	printf("@@@ Throughput (volumes/sec): %.3f\n", elapsed > 0 ? frames * 1e6 / elapsed : 0.0);
+	fflush(stdout);
+}
+
+// Where progressive passes are published: the output file, rewritten after each pass
+typedef struct publish_target{
+	FILE *file;
+	size_t points;
+	uint64_t start;
+}publish_target;
+
+/* Print the plan's status lines added since the last call */
+void print_plan_status(const bf_plan *plan, size_t *shown)
+{
+	const char *status = bf_plan_status(plan);
+
+	printf("%s", status + *shown);
+	*shown = strlen(status);
+}
+
+void publish_pass(void *user, const float *volume, int pass, int passes)
+{
+	publish_target *target = (publish_target *) user;
+
+	rewind(target->file);
+	fwrite(volume, sizeof(float), target->points, target->file);
+	fflush(target->file);
+	printf("Pass %d/%d published after %lld usec\n", pass + 1, passes,
+			(long long)(now_usec() - target->start));
+	fflush(stdout);
+}
+
+/* RMS difference between two images, the metric solution_check.c reports */
+double image_rms(const float *a, const float *b)
+{
+	double diff_value = 0;
+	int num_pts = pts_r * sls_t * sls_p;
+	int i;
+
+	for (i = 0; i < num_pts; i++)
+		diff_value += (a[i] - b[i]) * (double)(a[i] - b[i]);
+	return sqrt(diff_value / num_pts);
+}
+
+/* Recompute image with the exact reference path (sqrt distances, float samples) and report how
+ * far the approximations in the current settings moved it. image keeps the
+ * approximate result. */
+void run_check()
+{
+	engine_config current, reference;
+	bf_times times;
+	size_t image_bytes = (size_t)pts_r * sls_t * sls_p * sizeof(float);
+	float *approx = (float *) malloc(image_bytes);
+
+	if (approx == NULL) {
+		fprintf(stderr, "Bad malloc on check image\n");
+		return;
+	}
+	memcpy(approx, image, image_bytes);
+
+	save_config(&current);
+	reference = current;
+	reference.use_tables = 0;
+	reference.rx_format = RX_FLOAT;
+	reference.symmetry = 0;
+	load_config(&reference);
+	compute_image(&times);
+	load_config(&current);
+	reuse_dist_tx = 0; // dist_tx now holds the reference's distances
+
+	printf("Check RMS vs exact float path: %e\n", image_rms(approx, image));
+	memcpy(image, approx, image_bytes);
+	free(approx);
+}
+
+/* Per-thread counters and task time of the last compute_image, one table per phase.
+ * Skew is the ratio of the busiest to the least busy thread's task time. */
+void report_perf()
+{
+	static const char *phase_names[PERF_PHASES] = {"transmit", "reflect", "merge"};
+	uint64_t *row, busy_min, busy_max;
+	int phase, slot, event, opened = 0;
+
+	for (event = 0; event < PERF_EVENTS; event++)
+		opened += perf_fd[perf_slots - 1][event] >= 0;
+	if (opened == 0)
+		printf("Perf counters unavailable (%s), reporting task time only\n", strerror(perf_errno));
+	else if (opened < PERF_EVENTS)
+		printf("Some perf counters unavailable (%s), shown as -\n", strerror(perf_errno));
+
+	for (phase = 0; phase < PERF_PHASES; phase++) {
+		printf("Perf %s:\n  %-6s", phase_names[phase], "thread");
+		for (event = 0; event < PERF_EVENTS; event++)
+			printf(" %15s", perf_event_names[event]);
+		printf(" %6s %12s\n", "IPC", "busy-usec");
+
+		busy_min = busy_max = perf_phase[phase][PERF_EVENTS];
+		for (slot = 0; slot < perf_slots; slot++) {
+			row = perf_phase[phase] + slot * (PERF_EVENTS + 1);
+			printf("  %-6d", slot);
+			for (event = 0; event < PERF_EVENTS; event++) {
+				if (perf_fd[slot][event] >= 0)
+					printf(" %15llu", (unsigned long long)row[event]);
+				else
+					printf(" %15s", "-");
+			}
+			if (row[0] > 0)
+				printf(" %6.2f", (double)row[1] / row[0]);
+			else
+				printf(" %6s", "-");
+			printf(" %12llu\n", (unsigned long long)row[PERF_EVENTS]);
+			if (row[PERF_EVENTS] < busy_min) busy_min = row[PERF_EVENTS];
+			if (row[PERF_EVENTS] > busy_max) busy_max = row[PERF_EVENTS];
+		}
+		printf("  skew: busy max/min %.2f (max %llu, min %llu usec)\n",
+				busy_min > 0 ? (double)busy_max / busy_min : 0.0,
+				(unsigned long long)busy_max, (unsigned long long)busy_min);
+	}
+}
+
+void usage(char *prog)
+{
+	printf("Usage: %s {16|32|64|N} [--input=FILE] [--output=FILE] [--reflect=tiled|receiver] [--tile=N] [--tile-len=N] [--reduce=owner|private]\n"
+			"       [--roi=T0:T1,P0:P1,R0:R1] [--decimate=K] [--progressive=K]\n"
+			"       [--simd=auto|scalar|avx2|avx512] [--geometry=auto|stored|param]\n"
+			"       [--load=read|mmap|pipeline] [--populate] [--hugepages]\n"
+			"       [--bench=N] [--warmup=N] [--variants=og,outer_loop,beamform]\n"
+			"       [--threads=N] [--transmit-tasks=N] [--reflect-tasks=N] [--x-tasks=N]\n"
+			"       [--autotune[=force]] [--tune-file=FILE] [--stream=FILE|-]\n"
+			"       [--check] [--table-mb=N]\n"
+			"       [--rx-format=float|fp16|int16] [--specialize=on|off] [--symmetry=on|off]\n"
+			"       [--numa] [--perf]\n", prog);
+	fflush(stdout);
+	exit(-1);
+}
+
+void parse_options(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2 || atoi(argv[1]) <= 0)
+		usage(argv[0]);
+
+	for (i = 2; i < argc; i++) {
+		if (!strncmp(argv[i], "--input=", 8))
+			input_path = argv[i] + 8;
+		else if (!strncmp(argv[i], "--output=", 9))
+			output_path = argv[i] + 9;
+		else if (!strcmp(argv[i], "--reflect=tiled"))
+			reflect_engine = REFLECT_TILED;
+		else if (!strcmp(argv[i], "--reflect=receiver"))
+			reflect_engine = REFLECT_RECEIVER;
+		else if (!strncmp(argv[i], "--roi=", 6) && sscanf(argv[i] + 6, "%d:%d,%d:%d,%d:%d", &roi_t_start, &roi_t_end,
+				&roi_p_start, &roi_p_end, &roi_r_start, &roi_r_end) == 6)
+			;
+		else if (!strncmp(argv[i], "--decimate=", 11) && atoi(argv[i] + 11) > 0)
+			r_step = atoi(argv[i] + 11);
+		else if (!strncmp(argv[i], "--progressive=", 14) && atoi(argv[i] + 14) > 0)
+			progressive = atoi(argv[i] + 14);
+		else if (!strncmp(argv[i], "--tile=", 7) && atoi(argv[i] + 7) > 0)
+			tile_pts = atoi(argv[i] + 7);
+		else if (!strncmp(argv[i], "--tile-len=", 11) && atoi(argv[i] + 11) > 0)
+			tile_len = atoi(argv[i] + 11);
+		else if (!strcmp(argv[i], "--reduce=owner"))
+			reduce_mode = REDUCE_OWNER;
+		else if (!strcmp(argv[i], "--reduce=private"))
+			reduce_mode = REDUCE_PRIVATE;
+		else if (!strcmp(argv[i], "--geometry=auto"))
+			geometry_mode = GEOMETRY_AUTO;
+		else if (!strcmp(argv[i], "--geometry=param"))
+			geometry_mode = GEOMETRY_PARAM;
+		else if (!strcmp(argv[i], "--geometry=stored"))
+			geometry_mode = GEOMETRY_STORED;
+		else if (!strcmp(argv[i], "--load=read"))
+			load_mode = LOAD_READ;
+		else if (!strcmp(argv[i], "--load=mmap"))
+			load_mode = LOAD_MMAP;
+		else if (!strcmp(argv[i], "--load=pipeline"))
+			load_mode = LOAD_PIPELINE;
+		else if (!strcmp(argv[i], "--populate"))
+			map_populate = 1;
+		else if (!strcmp(argv[i], "--hugepages"))
+			map_hugepages = 1;
+		else if (!strncmp(argv[i], "--bench=", 8) && atoi(argv[i] + 8) > 0)
+			bench_trials = atoi(argv[i] + 8);
+		else if (!strncmp(argv[i], "--warmup=", 9) && atoi(argv[i] + 9) >= 0)
+			bench_warmup = atoi(argv[i] + 9);
+		else if (!strncmp(argv[i], "--variants=", 11))
+			bench_variants = argv[i] + 11;
+		else if (!strncmp(argv[i], "--threads=", 10) && atoi(argv[i] + 10) > 0)
+			num_threads = atoi(argv[i] + 10);
+		else if (!strncmp(argv[i], "--transmit-tasks=", 17) && atoi(argv[i] + 17) > 0)
+			transmit_tasks = atoi(argv[i] + 17);
+		else if (!strncmp(argv[i], "--reflect-tasks=", 16) && atoi(argv[i] + 16) > 0)
+			reflect_tasks = atoi(argv[i] + 16);
+		else if (!strncmp(argv[i], "--x-tasks=", 10) && atoi(argv[i] + 10) > 0)
+			x_tasks = atoi(argv[i] + 10);
+		else if (!strcmp(argv[i], "--autotune"))
+			autotune = TUNE_CACHED;
+		else if (!strcmp(argv[i], "--autotune=force"))
+			autotune = TUNE_FORCE;
+		else if (!strncmp(argv[i], "--tune-file=", 12))
+			tune_path = argv[i] + 12;
+		else if (!strncmp(argv[i], "--stream=", 9))
+			stream_path = argv[i] + 9;
+		else if (!strncmp(argv[i], "--table-mb=", 11) && atoi(argv[i] + 11) >= 0)
+			table_mb = atoi(argv[i] + 11);
+		else if (!strcmp(argv[i], "--rx-format=float"))
+			rx_format = RX_FLOAT;
+		else if (!strcmp(argv[i], "--rx-format=fp16"))
+			rx_format = RX_HALF;
+		else if (!strcmp(argv[i], "--rx-format=int16"))
+			rx_format = RX_INT16;
+		else if (!strcmp(argv[i], "--specialize=on"))
+			specialize = 1;
+		else if (!strcmp(argv[i], "--specialize=off"))
+			specialize = 0;
+		else if (!strcmp(argv[i], "--symmetry=on"))
+			symmetry = 1;
+		else if (!strcmp(argv[i], "--symmetry=off"))
+			symmetry = 0;
+		else if (!strcmp(argv[i], "--perf"))
+			perf_mode = 1;
+		else if (!strcmp(argv[i], "--numa"))
+			numa_mode = 1;
+		else if (!strcmp(argv[i], "--check"))
+			check_exact = 1;
+		else if (!strcmp(argv[i], "--simd=auto"))
+			simd_mode = SIMD_AUTO;
+		else if (!strcmp(argv[i], "--simd=scalar"))
+			simd_mode = SIMD_SCALAR;
+		else if (!strcmp(argv[i], "--simd=avx2"))
+			simd_mode = SIMD_AVX2;
+		else if (!strcmp(argv[i], "--simd=avx512"))
+			simd_mode = SIMD_AVX512;
+		else {
+			printf("Unknown option %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+}
+
+/* Plan settings from the command line (which parse_options left in the globals) */
+void cli_options(bf_options *options)
+{
+	bf_default_options(options);
+	options->reflect_engine = reflect_engine;
+	options->reduce_mode = reduce_mode;
+	options->simd_mode = simd_mode;
+	options->geometry_mode = geometry_mode;
+	options->rx_format = rx_format;
+	options->specialize = specialize;
+	options->symmetry = symmetry;
+	options->tile_pts = tile_pts;
+	options->tile_len = tile_len;
+	options->transmit_tasks = transmit_tasks;
+	options->reflect_tasks = reflect_tasks;
+	options->x_tasks = x_tasks;
+	options->threads = num_threads;
+	options->table_mb = table_mb;
+	options->roi_t_start = roi_t_start;
+	options->roi_t_end = roi_t_end;
+	options->roi_p_start = roi_p_start;
+	options->roi_p_end = roi_p_end;
+	options->roi_r_start = roi_r_start;
+	options->roi_r_end = roi_r_end;
+	options->r_step = r_step;
+	// The og and outer_loop benchmark variants read the stored points
+	options->keep_points = bench_trials > 0 && (strstr(bench_variants, "og") || strstr(bench_variants, "outer_loop"));
+}
+
+int main (int argc, char **argv) {
+
+	int node, pass;
+	bf_options options;
+	bf_plan *plan;
+	bf_progressive *prog = NULL;
+	int private_merge;
+	int shape_t, shape_p, shape_r;
+	size_t status_shown = 0;
+	uint64_t launch = now_usec();
+
+	read_env();
+	parse_options(argc, argv);
+	size = atoi(argv[1]);
+
+	/* Variables for image space points */
+	sls_t = size; // Number of scanlines in theta
+	sls_p = size; // Number of scanlines in phi
+	total_angles = sls_p * sls_t;
+
+	if (numa_mode)
+		read_numa_topology();
+	allocate_space();
+
+
+    FILE* input;
+    FILE* output;
+
+	// read cmd line input
+		char buff[256];
+		if (input_path != NULL)
+			snprintf(buff, sizeof(buff), "%s", input_path);
+		else
+			#ifdef __MIC__
+		sprintf(buff, "/beamforming_input_%s.bin", argv[1]);
+			#else // !__MIC__
+		sprintf(buff, "/n/typhon/data1/home/eecs570/beamforming_input_%s.bin", argv[1]);
+			#endif
+		input = fopen(buff,"rb");
+		if (!input) {
+			printf("Unable to open input file %s.\n", buff);
+			fflush(stdout);
+			exit(-1);
+		}	
+	//
+
+	uint64_t load_start = now_usec();
+	if (load_mode == LOAD_MMAP)
+		map_binary(input);
+	else if (load_mode == LOAD_PIPELINE)
+		pipeline_binary(input);
+	else
+		read_binary(input);
+	cli_options(&options);
+	options.borrow_points = input_map != NULL; // Mapped points are read in place, as before plans
+	plan = bf_plan_create(size, rx_x, rx_y, point_x, point_y, point_z, &options);
+	if (plan == NULL) {
+		printf("Unable to set up beamforming plan (bad size or region).\n");
+		fflush(stdout);
+		exit(-1);
+	}
+	print_plan_status(plan, &status_shown);
+	// Progressive passes only apply to a single frame
+	if (progressive > 1 && stream_path == NULL && bench_trials == 0) {
+		prog = progressive_passes(plan, 0, progressive); // Sharing the plan's geometry
+		if (prog == NULL) {
+			printf("Unable to set up progressive passes.\n");
+			fflush(stdout);
+			exit(-1);
+		}
+	}
+	// The plan has its own copy of the points, or borrows the mapping until free_input
+	if (input_map == NULL) {
+		free(point_x);
+		free(point_y);
+		free(point_z);
+	}
+	point_x = point_y = point_z = NULL;
+	uint64_t load_time = now_usec() - load_start;
+
+
+	printf("Beginning computation\n");
+	fflush(stdout);
+	if (numa_mode)
+		printf("NUMA: %d node%s, workers pinned\n", pool_nodes, pool_nodes > 1 ? "s" : "");
+
+	bf_plan_shape(plan, &shape_t, &shape_p, &shape_r);
+	if (shape_t != sls_t || shape_p != sls_p || shape_r != pts_r)
+		printf("Region: theta %d..%d, phi %d..%d, radial %d..%d every %d, image %dx%dx%d\n",
+				roi_t_start, roi_t_start + shape_t - 1, roi_p_start, roi_p_start + shape_p - 1,
+				roi_r_start, roi_r_start + (shape_r - 1) * r_step, r_step, shape_t, shape_p, shape_r);
+
+	// Benchmark and autotune runs work on the plan directly, and on the whole frame
+	if (autotune != TUNE_OFF || (stream_path == NULL && bench_trials > 0))
+		finish_pipeline();
+	plan_enter(plan);
+	if (autotune != TUNE_OFF) {
+		plan_load_frame(rx_data);
+		run_autotune();
+	}
+	printf("Reflect kernel: %s, %s sizes, symmetry %s\n", simd_name(simd_mode), spec_name(),
+			symmetry_name(symmetry_mirrors()));
+	if (stream_path == NULL && bench_trials > 0) {
+		plan_load_frame(rx_data);
+		run_benchmark(load_time);
+	}
+	private_merge = reduce_mode == REDUCE_PRIVATE;
+	plan_leave(plan);
+	print_plan_status(plan, &status_shown);
+
+	if (stream_path != NULL) {
+		finish_pipeline(); // The stream brings its own frames
+		run_stream(plan);
+		print_plan_status(plan, &status_shown);
+	} else {
+		if (bench_trials == 0 && prog != NULL) {
+			bf_progress_times progress;
+			publish_target target;
+
+			target.file = fopen(output_filename(), "wb");
+			if (!target.file) {
+				printf("Unable to open output file %s.\n", output_filename());
+				fflush(stdout);
+				exit(-1);
+			}
+			target.points = bf_image_points(plan);
+			target.start = now_usec();
+			bf_progressive_execute(prog, rx_data, image, publish_pass, &target, &progress);
+			fclose(target.file);
+			for (pass = 0; pass < prog->passes; pass++) {
+				size_t pass_shown = 0; // The passes' notes are their own, delay tables only
+				print_plan_status(prog->plans[pass], &pass_shown);
+			}
+			printf("@@@ Time to first image (usec): %lld\n", (long long)progress.first);
+			printf("@@@ Time to final image (usec): %lld\n", (long long)progress.final);
+			if (check_exact) {
+				plan_enter(plan);
+				run_check();
+				plan_leave(plan);
+			}
+		} else if (bench_trials == 0) {
+			bf_times times;
+			bf_execute(plan, rx_data, image, &times);
+			print_plan_status(plan, &status_shown);
+			if (rx_arrival != NULL) {
+				finish_pipeline();
+				printf("Receive data: streamed during setup and compute, reflect waited %lld usec, last row at %lld usec\n",
+						(long long)loader.gate.waited, (long long)(loader.done - launch));
+			}
+
+			if (rx_format != RX_FLOAT)
+				printf("Channel data: %s (%zu MB), converted in %lld usec\n", rx_format_name(rx_format),
+						((size_t)data_len * trans_x * trans_y * sizeof(uint16_t)) >> 20,
+						(long long)times.prepare);
+			printf("Transmit time (usec): %lld\n", (long long)times.transmit);
+			printf("Reflect time (usec): %lld\n", (long long)times.reflect);
+			if (private_merge)
+				printf("Merge time (usec): %lld\n", (long long)times.merge);
+			printf("@@@ Elapsed time (usec): %lld\n", (long long)(times.transmit + times.reflect + times.merge));
+			if (numa_mode)
+				for (node = 0; node < pool_nodes; node++)
+					printf("Node %d: %.1f MB local, %.1f MB remote, %.2f GB/s modeled reflect traffic\n", node,
+							node_local_bytes[node] / 1e6, node_remote_bytes[node] / 1e6,
+							(node_local_bytes[node] + node_remote_bytes[node]) / (times.reflect * 1e3));
+			if (perf_mode)
+				report_perf();
+			if (pool_share() > 0)
+				printf("Scheduler: %llu steals across %d threads\n", (unsigned long long)pool.steals,
+						pool_share() + 1);
+			if (window_sweeps > 0)
+				printf("Channel window: %.1f of %d samples on average per tile and receiver\n",
+						(double)window_samples / window_sweeps, data_len);
+			if (check_exact) {
+				plan_enter(plan);
+				run_check();
+				plan_leave(plan);
+			}
+		}
+		printf("Processing complete.  Preparing output.\n");
+		fflush(stdout);
+
+		/* Write result to file, which progressive runs did with their last pass */
+		if (prog == NULL) {
+			output = fopen(output_filename(),"wb");
+			if (!output) {
+				printf("Unable to open output file %s.\n", output_filename());
+				fflush(stdout);
+				exit(-1);
+			}
+			fwrite(image, sizeof(float), bf_image_points(plan), output);
+			fclose(output);
+		}
+	}
+
+	printf("Output complete.\n");
+	printf("@@@ End-to-end time (usec): %lld\n", (long long)(now_usec() - launch));
+	fflush(stdout);
+	finish_pipeline();
 
 	/* Cleanup */
-	free(rx_x);
-	free(rx_y);
-	free(rx_data);
-	free(point_x);
-	free(point_y);
-	free(point_z);
-	free(dist_tx);
+	bf_progressive_destroy(prog);
+	bf_plan_destroy(plan);
+	free_input();
 	free(image);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+#endif // BEAMFORM_LIB
@@ -0,0 +1,130 @@
+// 3D Ultrasound beamforming library interface for EECS 570
+// Build beamform.c with -DBEAMFORM_LIB to get the library without the command-line
+// front end, e.g. gcc -O3 -DBEAMFORM_LIB -c beamform.c -o beamform_lib.o
+//
+// The probe is fixed at 32x32 receivers with 12308 samples per channel and 1560
+// radial points per scanline; size sets the size x size scanline grid.
+
+#ifndef BEAMFORM_H
+#define BEAMFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REFLECT_RECEIVER 0 // One receiver at a time over the whole image (divide_x_image)
+#define REFLECT_TILED 1 // All receivers over one cache-sized tile of points (reflect_tile)
+
+#define REDUCE_OWNER 0 // Tasks own disjoint image regions and write image directly
+#define REDUCE_PRIVATE 1 // Receiver groups fill private images merged at the end
+
+#define GEOMETRY_AUTO -1 // Parametric if the model reproduces the stored points exactly, else stored
+#define GEOMETRY_STORED 0 // Read point_x/point_y/point_z arrays
+#define GEOMETRY_PARAM 1 // Generate points from per-scanline origin and radial step (within 1e-7 m of the stored ones)
+
+#define RX_FLOAT 0 // rx_data samples as read
+#define RX_HALF 1 // IEEE fp16 copy, converted at load time
+#define RX_INT16 2 // int16 copy scaled by rx_scale
+
+#define SIMD_AUTO -1 // AVX2 when the CPU has it, else scalar (AVX-512 only on request or by the autotuner)
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+// Engine settings of a plan, see bf_default_options for the defaults
+typedef struct bf_options{
+	int reflect_engine;
+	int reduce_mode;
+	int simd_mode;
+	int geometry_mode;
+	int rx_format;
+	int tile_pts; // Image points per reflect tile
+	int tile_len; // Radial points per scanline in a tile
+	int transmit_tasks;
+	int reflect_tasks;
+	int x_tasks;
+	int threads; // Threads the plan runs on, the calling one included, 0 = one per online core
+	int table_mb; // Delay table budget, 0 disables the tables; kept only if they time faster
+	int keep_points; // Keep the stored points even when the geometry fits the parametric model
+	int borrow_points; // Use the caller's point arrays in place instead of copying them (whole grid only)
+	int specialize; // Use fixed-size kernels when the size and probe have them
+	int symmetry; // Share receive distances between mirrored pairs when the geometry is symmetric
+	int roi_t_start, roi_t_end; // Region of interest: theta rows roi_t_start..roi_t_end-1, end 0 = to the last (< 0 is rejected)
+	int roi_p_start, roi_p_end; // Phi columns, likewise
+	int roi_r_start, roi_r_end; // Radial points, likewise
+	int r_step; // Keep every r_step-th radial point of the region (decimated preview), 1 = all
+}bf_options;
+
+// Phase times of one bf_execute, in usec. prepare covers the 16-bit conversion and
+// NUMA replication of the frame, transmit is 0 once dist_tx is cached.
+typedef struct bf_times{
+	uint64_t prepare;
+	uint64_t transmit;
+	uint64_t reflect;
+	uint64_t merge;
+}bf_times;
+
+typedef struct bf_plan bf_plan;
+
+void bf_default_options(bf_options *options);
+
+/* Set up a size x size plan for one probe geometry: rx_x/rx_y hold the 1024 receiver
+ * positions and point_x/y/z the 1560 * size * size image points, in the input file
+ * layout. Only the region of interest in options is copied and beamformed; its image
+ * is packed the same way (theta row, phi column, radial point), see bf_plan_shape.
+ * Everything is copied, so the arrays may be freed afterwards, unless borrow_points
+ * is set and the region is the whole grid: then point_x/y/z (e.g. a read-only mapping
+ * of the input file) are read in place, must outlive the plan, and are not placed
+ * over NUMA nodes. Returns NULL on a bad size or region, or allocation failure. */
+bf_plan *bf_plan_create(int size, const float *rx_x, const float *rx_y,
+		const float *point_x, const float *point_y, const float *point_z, const bf_options *options);
+
+/* Beamform one frame of channel data (bf_frame_samples floats, receiver-major) into
+ * out_image (bf_image_points floats). Transmit distances and delay tables are computed
+ * by the first call and reused after that. Any thread may call this on a shared plan;
+ * calls on one plan run one at a time, calls on different plans side by side, each
+ * on its options.threads of the one worker pool. times may be NULL. */
+void bf_execute(bf_plan *plan, const float *rx_data, float *out_image, bf_times *times);
+
+void bf_plan_destroy(bf_plan *plan);
+
+size_t bf_image_points(const bf_plan *plan);
+void bf_plan_shape(const bf_plan *plan, int *theta, int *phi, int *radial); // Image dimensions of the region
+size_t bf_frame_samples(void);
+const char *bf_plan_kernel(const bf_plan *plan); // SIMD kernel the plan runs
+
+/* What setting the plan up decided or fell back to (geometry fit, kernel, delay tables
+ * after the first execute), one line each; "" if nothing. The library prints nothing
+ * itself. Valid until the plan's next bf_execute. */
+const char *bf_plan_status(const bf_plan *plan);
+
+// Progressive execution: the region's radial points are split into passes interleaved
+// sets (points j, j + passes, j + 2 * passes, ... for pass j). The passes share one
+// copy of the geometry and its fit; each only has its own transmit distances.
+// The first pass gives a coarse volume after about 1/passes of the work; every later
+// pass fills its points in without touching the ones already computed.
+typedef struct bf_progressive bf_progressive;
+
+// Called after each pass with the whole image: points of passes 0..pass are final,
+// the rest repeat the nearest final point below them on their scanline
+typedef void (*bf_publish_fn)(void *user, const float *image, int pass, int passes);
+
+// Usec from the start of bf_progressive_execute to the first and to the final image
+typedef struct bf_progress_times{
+	uint64_t first;
+	uint64_t final;
+}bf_progress_times;
+
+/* Same arguments as bf_plan_create, plus the number of passes (clamped to the region's
+ * radial points). Returns NULL where bf_plan_create would. */
+bf_progressive *bf_progressive_create(int size, const float *rx_x, const float *rx_y,
+		const float *point_x, const float *point_y, const float *point_z, const bf_options *options,
+		int passes);
+
+/* Beamform one frame into out_image (the region's bf_image_points floats) pass by pass,
+ * calling publish (if not NULL) after each. times may be NULL. */
+void bf_progressive_execute(bf_progressive *prog, const float *rx_data, float *out_image,
+		bf_publish_fn publish, void *user, bf_progress_times *times);
+
+void bf_progressive_destroy(bf_progressive *prog);
+
+#endif
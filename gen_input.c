@@ -0,0 +1,284 @@
+// 3D Ultrasound beamforming synthetic input generator for EECS 570
+// Writes an input file in the layout read by beamform.c (rx_x, rx_y,
+// point_x, point_y, point_z, rx_data) for any size, plus the reference
+// solution computed with the beamform_og.c algorithm.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define NUM_SCATTERERS 32 // Point reflectors placed in the imaged volume
+
+/* Transducer and image constants shared with beamform.c */
+int trans_x = 32; // Transducers in x dim
+int trans_y = 32; // Transducers in y dim
+float pitch = 0.0003; // Transducer spacing (m)
+float rx_z = 0; // Receive transducer z position
+
+float tx_x = 0; // Transmit transducer x position
+float tx_y = 0; // Transmit transducer y position
+float tx_z = -0.001; // Transmit transducer z position
+
+int pts_r = 1560; // Radial points along scanline
+float r_start = 0.002; // Radius of the first radial point (m)
+float r_step = 0.00003; // Radial point spacing (m)
+float max_angle = 0.3; // Scanlines span -max_angle..max_angle rad in theta and phi
+
+const float idx_const = 0.000009625; // Speed of sound and sampling rate, converts dist to index
+const int filter_delay = 140; // Constant added to index to account filter delay (off by 1 from MATLAB)
+int data_len = 12308; // Number for pre-processed data values per channel
+
+float pulse_freq = 0.22; // Pulse centre frequency (cycles per sample)
+float pulse_width = 6; // Gaussian envelope width (samples)
+float noise_level = 0.02; // Uniform noise amplitude added to every sample
+
+/* Small deterministic generator so inputs are reproducible across machines */
+unsigned int rng_state = 1;
+
+float rng_uniform()
+{
+	rng_state = rng_state * 1103515245u + 12345u;
+	return ((rng_state >> 8) & 0xffffff) / (float)0x1000000;
+}
+
+float dist3(float ax, float ay, float az, float bx, float by, float bz)
+{
+	float x_comp = ax - bx;
+	float y_comp = ay - by;
+	float z_comp = az - bz;
+	return (float)sqrt(x_comp * x_comp + y_comp * y_comp + z_comp * z_comp);
+}
+
+void gen_transducers(float *rx_x, float *rx_y)
+{
+	int i, j;
+
+	for (i = 0; i < trans_x; i++) {
+		for (j = 0; j < trans_y; j++) {
+			rx_x[i * trans_y + j] = (i - (trans_x - 1) / 2.0f) * pitch;
+			rx_y[i * trans_y + j] = (j - (trans_y - 1) / 2.0f) * pitch;
+		}
+	}
+}
+
+void gen_points(int sls_t, int sls_p, float *point_x, float *point_y, float *point_z)
+{
+	int it_t, it_p, it_r;
+	int point = 0;
+	double theta, phi, dir_x, dir_y, dir_z, r;
+
+	for (it_t = 0; it_t < sls_t; it_t++) {
+		theta = sls_t > 1 ? -max_angle + 2.0 * max_angle * it_t / (sls_t - 1) : 0;
+		for (it_p = 0; it_p < sls_p; it_p++) {
+			phi = sls_p > 1 ? -max_angle + 2.0 * max_angle * it_p / (sls_p - 1) : 0;
+			dir_x = sin(theta) * cos(phi);
+			dir_y = sin(phi);
+			dir_z = cos(theta) * cos(phi);
+			for (it_r = 0; it_r < pts_r; it_r++) {
+				r = r_start + (double)r_step * it_r;
+				point_x[point] = (float)(r * dir_x);
+				point_y[point] = (float)(r * dir_y);
+				point_z[point] = (float)(r * dir_z);
+				point++;
+			}
+		}
+	}
+}
+
+/* Each channel gets a windowed sine pulse at the round-trip delay of every scatterer, plus noise */
+void gen_rx_data(float *rx_x, float *rx_y, float *rx_data)
+{
+	float sc_x[NUM_SCATTERERS], sc_y[NUM_SCATTERERS], sc_z[NUM_SCATTERERS], sc_amp[NUM_SCATTERERS];
+	float r, theta, phi, delay, k;
+	int it_rx, it_s, it_k, first, last;
+	float *data;
+
+	for (it_s = 0; it_s < NUM_SCATTERERS; it_s++) {
+		r = r_start + r_step * pts_r * (0.1f + 0.8f * rng_uniform());
+		theta = max_angle * (2 * rng_uniform() - 1);
+		phi = max_angle * (2 * rng_uniform() - 1);
+		sc_x[it_s] = r * sinf(theta) * cosf(phi);
+		sc_y[it_s] = r * sinf(phi);
+		sc_z[it_s] = r * cosf(theta) * cosf(phi);
+		sc_amp[it_s] = 0.5f + rng_uniform();
+	}
+
+	for (it_rx = 0; it_rx < trans_x * trans_y; it_rx++) {
+		data = rx_data + (size_t)it_rx * data_len;
+		for (it_k = 0; it_k < data_len; it_k++)
+			data[it_k] = noise_level * (2 * rng_uniform() - 1);
+
+		for (it_s = 0; it_s < NUM_SCATTERERS; it_s++) {
+			delay = (dist3(tx_x, tx_y, tx_z, sc_x[it_s], sc_y[it_s], sc_z[it_s]) +
+					dist3(rx_x[it_rx], rx_y[it_rx], rx_z, sc_x[it_s], sc_y[it_s], sc_z[it_s])) /
+					idx_const + filter_delay;
+			first = (int)(delay - 4 * pulse_width);
+			last = (int)(delay + 4 * pulse_width);
+			if (first < 0) first = 0;
+			if (last > data_len - 1) last = data_len - 1;
+			for (it_k = first; it_k <= last; it_k++) {
+				k = it_k - delay;
+				data[it_k] += sc_amp[it_s] * expf(-k * k / (2 * pulse_width * pulse_width)) *
+						sinf(2 * (float)M_PI * pulse_freq * k);
+			}
+		}
+	}
+}
+
+/* Reference delay-and-sum, same loop and arithmetic as beamform_og.c */
+void gen_solution(int num_pts, float *rx_x, float *rx_y, float *point_x, float *point_y,
+		float *point_z, float *rx_data, float *image)
+{
+	float *dist_tx;
+	float x_comp, y_comp, z_comp, dist;
+	int it_rx, point, index;
+	int offset = 0;
+
+	dist_tx = (float *) malloc(num_pts * sizeof(float));
+	if (dist_tx == NULL) fprintf(stderr, "Bad malloc on dist_tx\n");
+
+	for (point = 0; point < num_pts; point++) {
+		x_comp = tx_x - point_x[point];
+		x_comp = x_comp * x_comp;
+		y_comp = tx_y - point_y[point];
+		y_comp = y_comp * y_comp;
+		z_comp = tx_z - point_z[point];
+		z_comp = z_comp * z_comp;
+
+		dist_tx[point] = (float)sqrt(x_comp + y_comp + z_comp);
+	}
+
+	memset(image, 0, num_pts * sizeof(float));
+	for (it_rx = 0; it_rx < trans_x * trans_y; it_rx++) {
+		for (point = 0; point < num_pts; point++) {
+			x_comp = rx_x[it_rx] - point_x[point];
+			x_comp = x_comp * x_comp;
+			y_comp = rx_y[it_rx] - point_y[point];
+			y_comp = y_comp * y_comp;
+			z_comp = rx_z - point_z[point];
+			z_comp = z_comp * z_comp;
+
+			dist = dist_tx[point] + (float)sqrt(x_comp + y_comp + z_comp);
+			index = (int)(dist/idx_const + filter_delay + 0.5);
+			image[point] += rx_data[index+offset];
+		}
+		offset += data_len;
+	}
+	free(dist_tx);
+}
+
+int main (int argc, char **argv) {
+
+	int size, num_pts, num_rx;
+	char input_name[256];
+	char solution_name[256];
+	char frames_name[256] = "beamforming_frames.bin";
+	int write_solution = 1;
+	int num_frames = 0;
+	int i;
+	float *rx_x, *rx_y, *point_x, *point_y, *point_z, *rx_data, *image;
+	FILE *output;
+
+	if (argc < 2 || atoi(argv[1]) <= 0) {
+		printf("Usage: %s size [input_file] [solution_file|--no-solution] [--seed=N]\n"
+				"       [--frames=N] [--frames-file=FILE]\n", argv[0]);
+		fflush(stdout);
+		exit(-1);
+	}
+	size = atoi(argv[1]);
+	sprintf(input_name, "beamforming_input_%d.bin", size);
+	sprintf(solution_name, "beamforming_solution_%d.bin", size);
+
+	for (i = 2; i < argc; i++) {
+		if (!strncmp(argv[i], "--seed=", 7))
+			rng_state = (unsigned int)strtoul(argv[i] + 7, NULL, 10);
+		else if (!strcmp(argv[i], "--no-solution"))
+			write_solution = 0;
+		else if (!strncmp(argv[i], "--frames=", 9))
+			num_frames = atoi(argv[i] + 9);
+		else if (!strncmp(argv[i], "--frames-file=", 14))
+			snprintf(frames_name, sizeof(frames_name), "%s", argv[i] + 14);
+		else if (i == 2)
+			snprintf(input_name, sizeof(input_name), "%s", argv[i]);
+		else
+			snprintf(solution_name, sizeof(solution_name), "%s", argv[i]);
+	}
+
+	num_rx = trans_x * trans_y;
+	num_pts = pts_r * size * size;
+
+	rx_x = (float *) malloc(num_rx * sizeof(float));
+	rx_y = (float *) malloc(num_rx * sizeof(float));
+	point_x = (float *) malloc(num_pts * sizeof(float));
+	point_y = (float *) malloc(num_pts * sizeof(float));
+	point_z = (float *) malloc(num_pts * sizeof(float));
+	rx_data = (float *) malloc((size_t)data_len * num_rx * sizeof(float));
+	if (rx_x == NULL || rx_y == NULL || point_x == NULL || point_y == NULL ||
+			point_z == NULL || rx_data == NULL) {
+		fprintf(stderr, "Bad malloc on input arrays\n");
+		exit(-1);
+	}
+
+	gen_transducers(rx_x, rx_y);
+	gen_points(size, size, point_x, point_y, point_z);
+	gen_rx_data(rx_x, rx_y, rx_data);
+
+	output = fopen(input_name, "wb");
+	if (!output) {
+		printf("Unable to open output file %s.\n", input_name);
+		fflush(stdout);
+		exit(-1);
+	}
+	fwrite(rx_x, sizeof(float), num_rx, output);
+	fwrite(rx_y, sizeof(float), num_rx, output);
+	fwrite(point_x, sizeof(float), num_pts, output);
+	fwrite(point_y, sizeof(float), num_pts, output);
+	fwrite(point_z, sizeof(float), num_pts, output);
+	fwrite(rx_data, sizeof(float), (size_t)data_len * num_rx, output);
+	fclose(output);
+	printf("Wrote %s\n", input_name);
+
+	if (write_solution) {
+		image = (float *) malloc(num_pts * sizeof(float));
+		if (image == NULL) fprintf(stderr, "Bad malloc on image\n");
+		gen_solution(num_pts, rx_x, rx_y, point_x, point_y, point_z, rx_data, image);
+
+		output = fopen(solution_name, "wb");
+		if (!output) {
+			printf("Unable to open output file %s.\n", solution_name);
+			fflush(stdout);
+			exit(-1);
+		}
+		fwrite(image, sizeof(float), num_pts, output);
+		fclose(output);
+		free(image);
+		printf("Wrote %s\n", solution_name);
+	}
+
+	/* Frames for beamform --stream: frame 0 repeats the input's rx_data, later
+	 * frames move the scatterers */
+	if (num_frames > 0) {
+		output = fopen(frames_name, "wb");
+		if (!output) {
+			printf("Unable to open output file %s.\n", frames_name);
+			fflush(stdout);
+			exit(-1);
+		}
+		for (i = 0; i < num_frames; i++) {
+			if (i > 0) gen_rx_data(rx_x, rx_y, rx_data);
+			fwrite(rx_data, sizeof(float), (size_t)data_len * num_rx, output);
+		}
+		fclose(output);
+		printf("Wrote %d frames to %s\n", num_frames, frames_name);
+	}
+
+	free(rx_x);
+	free(rx_y);
+	free(point_x);
+	free(point_y);
+	free(point_z);
+	free(rx_data);
+
+	return 0;
+}
@@ -8,6 +8,12 @@
 
 int main (int argc, char **argv) {
 
+	if (argc < 2) {
+		printf("Usage: %s {16|32|64} [output_file] [solution_file]\n", argv[0]);
+		fflush(stdout);
+		exit(-1);
+	}
+
 	int size = atoi(argv[1]);
 
 	int pts_r = 1560; // Radial points along scanline
@@ -25,20 +31,34 @@ int main (int argc, char **argv) {
 	FILE *ftest;
 	FILE *ftrue;
 
-	char buff[128];
+	char buff[256];
+	if (argc > 3)
+	  snprintf(buff, sizeof(buff), "%s", argv[3]);
+	else
 	#ifdef __MIC__
 	  sprintf(buff, "/beamforming_solution_%s.bin", argv[1]);
 	#else //!__MIC__
 	  sprintf(buff, "/n/typhon/data1/home/eecs570/beamforming_solution_%s.bin", argv[1]);
 	#endif
 	ftrue = fopen(buff, "rb");
+	if (!ftrue) {
+		printf("Unable to open solution file %s.\n", buff);
+		exit(-1);
+	}
 
+	if (argc > 2)
+	  snprintf(buff, sizeof(buff), "%s", argv[2]);
+	else
 	#ifdef __MIC__
 	  sprintf(buff, "/home/micuser/beamforming_output.bin");
 	#else //!__MIC__
 	  sprintf(buff, "./beamforming_output.bin");
 	#endif
 	ftest = fopen(buff, "rb");
+	if (!ftest) {
+		printf("Unable to open output file %s.\n", buff);
+		exit(-1);
+	}
 
 	for (it_t = 0; it_t < sls_t; it_t++) {
 		for (it_p = 0; it_p < sls_p; it_p++) {